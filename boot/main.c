@@ -30,9 +30,10 @@
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one READ SECTORS can move
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
 
-void readsect(void*, uint32_t);
+void readsect(void*, uint32_t, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
 
 void
@@ -71,7 +72,7 @@ bad:
 void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	uint32_t end_pa;
+	uint32_t end_pa, nsect;
 
 	end_pa = pa + count;
 
@@ -81,17 +82,20 @@ readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	// translate from bytes to sectors, and kernel starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
+	// Read up to MAXSECTS sectors per disk command.  We might write
+	// more to memory than asked, but it doesn't matter -- we load in
+	// increasing order.
 	while (pa < end_pa) {
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		readsect((uint8_t*) pa, offset, nsect);
+		pa += nsect * SECTSIZE;
+		offset += nsect;
 	}
 }
 
@@ -103,23 +107,26 @@ waitdisk(void)
 		/* do nothing */;
 }
 
+// Read 'nsect' (1..MAXSECTS) sectors starting at sector 'offset'
+// into dst with a single disk command.
 void
-readsect(void *dst, uint32_t offset)
+readsect(void *dst, uint32_t offset, uint32_t nsect)
 {
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, nsect);	// count; 0 means 256
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
 	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
 
-	// wait for disk to be ready
-	waitdisk();
-
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+	// the disk raises DRQ once per sector
+	for (; nsect > 0; nsect--, dst += SECTSIZE) {
+		while ((inb(0x1F7) & 0x88) != 0x08)	// !BSY && DRQ
+			/* do nothing */;
+		insl(0x1F0, dst, SECTSIZE/4);
+	}
 }
 
@@ -24,14 +24,101 @@ va_is_dirty(void *va)
 	return (uvpt[PGNUM(va)] & PTE_D) != 0;
 }
 
+// Block reads in flight.  Each reads into a page of its own at
+// BCSTAGE, which is mapped at the block's address only once the read
+// has finished, so nobody ever sees a half-read block.
+struct BcRead {
+	struct IdeReq br_req;	// First, so bc_read_done can find us
+	uint32_t br_blockno;
+	bool br_busy;
+};
+
+static struct BcRead bc_reads[BC_NREADS];
+
+// The read of 'blockno' in flight, or NULL.
+static struct BcRead *
+bc_read_find(uint32_t blockno)
+{
+	struct BcRead *br;
+
+	for (br = bc_reads; br < bc_reads + BC_NREADS; br++)
+		if (br->br_busy && br->br_blockno == blockno)
+			return br;
+	return NULL;
+}
+
+// A block read has finished: put the block in the cache and run the
+// requests that were waiting for it again.
+static void
+bc_read_done(struct IdeReq *req)
+{
+	struct BcRead *br = (struct BcRead *) req;
+	void *addr = (void *) (DISKMAP + br->br_blockno * BLKSIZE);
+	int r;
+
+	if (req->ir_result < 0)
+		panic("ide_read: %e", req->ir_result);
+
+	// Mapping the page afresh leaves its dirty bit clear
+	if ((r = sys_page_map(0, req->ir_buf, 0, addr, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("in bc_read_done, sys_page_map: %e", r);
+	if ((r = sys_page_unmap(0, req->ir_buf)) < 0)
+		panic("in bc_read_done, sys_page_unmap: %e", r);
+	br->br_busy = 0;
+
+	// Check that the block we read was allocated. (exercise for
+	// the reader: why do we do this *after* reading the block
+	// in?)  Don't fault on the bitmap from in here, though.
+	if (bitmap && va_is_mapped(&bitmap[br->br_blockno / 32])
+	    && block_is_free(br->br_blockno))
+		panic("reading free block %08x\n", br->br_blockno);
+
+	serve_wake(br->br_blockno);
+}
+
+// Start reading 'blockno' into the cache.  If BC_NREADS reads are in
+// flight already, wait for one of them to finish first.
+static struct BcRead *
+bc_read_start(uint32_t blockno)
+{
+	struct BcRead *br;
+	void *stage;
+	int r;
+
+	while (1) {
+		for (br = bc_reads; br < bc_reads + BC_NREADS; br++)
+			if (!br->br_busy)
+				break;
+		if (br < bc_reads + BC_NREADS)
+			break;
+		ide_wait(&bc_reads[0].br_req);
+	}
+
+	stage = (void *) (BCSTAGE + (br - bc_reads) * PGSIZE);
+	if ((r = sys_page_alloc(0, stage, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	br->br_busy = 1;
+	br->br_blockno = blockno;
+	br->br_req.ir_secno = blockno * BLKSECTS;
+	br->br_req.ir_buf = stage;
+	br->br_req.ir_nsecs = BLKSECTS;
+	br->br_req.ir_write = 0;
+	br->br_req.ir_done = bc_read_done;
+	ide_submit(&br->br_req);
+	return br;
+}
+
 // Fault any disk block that is read in to memory by
-// loading it from disk.
+// loading it from disk.  If the file server is in the middle of a
+// request that can be restarted, it parks the request and goes on with
+// others while the block is read; otherwise we wait for the block here.
 static void
 bc_pgfault(struct UTrapframe *utf)
 {
 	void *addr = (void *) utf->utf_fault_va;
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
-	int r;
+	struct BcRead *br;
 
 	// Check that the fault was within the block cache region
 	if (addr < (void*)DISKMAP || addr >= (void*)(DISKMAP + DISKSIZE))
@@ -42,29 +129,14 @@ bc_pgfault(struct UTrapframe *utf)
 	if (super && blockno >= super->s_nblocks)
 		panic("reading non-existent block %08x\n", blockno);
 
-	// Allocate a page in the disk map region, read the contents
-	// of the block from the disk into that page.
-	// Hint: first round addr to page boundary. fs/ide.c has code to read
-	// the disk.
-	//
-	// LAB 5: you code here:
-    if ((r = sys_page_alloc(0, ROUNDDOWN(addr, PGSIZE), PTE_P | PTE_U | PTE_W)) < 0)
-        panic("sys_page_alloc: %e", r);
-
-    assert(!va_is_dirty(addr));
-    if ((r = ide_read(blockno * BLKSECTS, addr, BLKSECTS)) < 0)
-        panic("ide_read: %e", r);
+	// Another request may have asked for this block already.
+	if ((br = bc_read_find(blockno)) == NULL)
+		br = bc_read_start(blockno);
 
-	// Clear the dirty bit for the disk block page since we just read the
-	// block from disk
-	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
-		panic("in bc_pgfault, sys_page_map: %e", r);
-
-	// Check that the block we read was allocated. (exercise for
-	// the reader: why do we do this *after* reading the block
-	// in?)
-	if (bitmap && block_is_free(blockno))
-		panic("reading free block %08x\n", blockno);
+	// Without DMA the read is over already
+	if (br->br_req.ir_result > 0)
+		serve_defer(blockno);	// no return if it could park
+	ide_wait(&br->br_req);
 }
 
 // Flush the contents of the block containing VA out to disk if
@@ -76,6 +148,19 @@ bc_pgfault(struct UTrapframe *utf)
 // Hint: Don't forget to round addr down.
 void
 flush_block(void *addr)
+{
+    int r;
+
+    flush_block_queue(addr);
+    if ((r = batch_flush()) < 0)
+        panic("flush_block: %e", r);
+}
+
+// Like flush_block, but only queue the clearing of PTE_D as a batched
+// system call.  The caller must batch_flush() before the block can be
+// written again, or the write could be forgotten.
+void
+flush_block_queue(void *addr)
 {
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
 
@@ -88,8 +173,8 @@ flush_block(void *addr)
         if ((r = ide_write(blockno * BLKSECTS, ROUNDDOWN(addr, PGSIZE), BLKSECTS)) < 0)
             panic("ide_write: %e", r);
 
-        if ((r = sys_page_map(0, ROUNDDOWN(addr, PGSIZE), 0, ROUNDDOWN(addr, PGSIZE), uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
-            panic("sys_page_map: %e", r);
+        if ((r = batch_page_map(0, ROUNDDOWN(addr, PGSIZE), 0, ROUNDDOWN(addr, PGSIZE), uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
+            panic("batch_page_map: %e", r);
     }
 }
 
@@ -117,6 +117,7 @@ fs_init(void)
 		ide_set_disk(1);
 	else
 		ide_set_disk(0);
+	ide_dma_init();
 	bc_init();
 
 	// Set "super" to point to the super block.
@@ -492,8 +493,10 @@ file_flush(struct File *f)
 void
 fs_sync(void)
 {
-	int i;
+	int i, r;
 	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+		flush_block_queue(diskaddr(i));
+	if ((r = batch_flush()) < 0)
+		panic("fs_sync: %e", r);
 }
 
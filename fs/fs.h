@@ -11,21 +11,44 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Block reads in flight land in pages at BCSTAGE (bc.c); requests
+ * waiting for them park their pages at SERVDEFER (serv.c).  Both are
+ * above the open file table at 0xD0000000. */
+#define BC_NREADS	8
+#define BCSTAGE		0xD0400000
+#define SERVDEFER	(BCSTAGE + BC_NREADS * PGSIZE)
+
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
 /* ide.c */
+// A disk transfer queued with ide_submit.
+struct IdeReq {
+	uint32_t ir_secno;		// First sector
+	void *ir_buf;			// Mapped buffer of ir_nsecs sectors
+	size_t ir_nsecs;		// 1..256
+	bool ir_write;
+	int ir_result;			// 1 until done, then 0 or < 0
+	void (*ir_done)(struct IdeReq *);	// Called when done, or NULL
+	struct IdeReq *ir_next;		// Next in the disk queue
+};
+
 bool	ide_probe_disk1(void);
 void	ide_set_disk(int diskno);
 void	ide_set_partition(uint32_t first_sect, uint32_t nsect);
+void	ide_dma_init(void);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
+void	ide_submit(struct IdeReq *req);
+void	ide_poll(void);
+int	ide_wait(struct IdeReq *req);
 
 /* bc.c */
 void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	flush_block_queue(void *addr);
 void	bc_init(void);
 
 /* fs.c */
@@ -44,6 +67,10 @@ void	fs_sync(void);
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
 
+/* serv.c */
+void	serve_defer(uint32_t blockno);
+void	serve_wake(uint32_t blockno);
+
 /* test.c */
 void	fs_test(void);
 
@@ -1,5 +1,8 @@
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * Minimal IDE driver code.  Transfers use the controller's bus-master
+ * DMA engine when the kernel found one, and PIO otherwise.  Requests
+ * are queued; a DMA request completes in the background, and the
+ * kernel tells us when (see ide_poll).
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
  */
@@ -12,8 +15,38 @@
 #define IDE_DF		0x20
 #define IDE_ERR		0x01
 
+#define IDE_CMD_READ		0x20
+#define IDE_CMD_WRITE		0x30
+#define IDE_CMD_READ_DMA	0xC8
+#define IDE_CMD_WRITE_DMA	0xCA
+
+// Bus-master DMA registers of the primary channel, relative to the
+// port sys_ide_dma_base() returns.
+#define BM_CMD		0
+#define   BM_CMD_START	0x01	//   Start the transfer
+#define   BM_CMD_READ	0x08	//   Device to memory
+#define BM_STATUS	2
+#define   BM_STATUS_ACTIVE 0x01	//   Transfer in progress
+#define   BM_STATUS_ERR	0x02	//   DMA error (write 1 to clear)
+#define   BM_STATUS_INTR 0x04	//   Device interrupted (write 1 to clear)
+#define BM_PRDT		4	// Physical address of the PRD table
+
+// A physical region descriptor: one contiguous piece of a transfer,
+// which must not cross a 64KB boundary.
+struct Prd {
+	uint32_t prd_addr;
+	uint16_t prd_len;	// bytes; 0 means 64KB
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000	// Last entry in the table
+
 static int diskno = 1;
 
+static int bmbase;		// Bus-master port base, or 0 for PIO
+static struct Prd prdt[PGSIZE / sizeof(struct Prd)]
+	__attribute__((aligned(PGSIZE)));
+static physaddr_t prdt_pa;
+
 static int
 ide_wait_ready(bool check_error)
 {
@@ -60,13 +93,29 @@ ide_set_disk(int d)
 }
 
 
-int
-ide_read(uint32_t secno, void *dst, size_t nsecs)
+// Use bus-master DMA for transfers if the controller supports it.
+void
+ide_dma_init(void)
 {
 	int r;
 
-	assert(nsecs <= 256);
+	if ((bmbase = sys_ide_dma_base()) < 0) {
+		bmbase = 0;
+		return;
+	}
+	// prdt is in our bss, so it is mapped and stays put
+	if ((r = sys_page_pa(prdt)) < 0)
+		panic("sys_page_pa: %e", r);
+	prdt_pa = r;
+
+	// Let the disk raise its interrupt line (clear nIEN): completion
+	// shows up as BM_STATUS_INTR
+	outb(0x3F6, 0);
+}
 
+static void
+ide_start(uint32_t secno, size_t nsecs, uint8_t cmd)
+{
 	ide_wait_ready(0);
 
 	outb(0x1F2, nsecs);
@@ -74,39 +123,184 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
 	outb(0x1F4, (secno >> 8) & 0xFF);
 	outb(0x1F5, (secno >> 16) & 0xFF);
 	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x20);	// CMD 0x20 means read sector
+	outb(0x1F7, cmd);
+}
 
-	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		insl(0x1F0, dst, SECTSIZE/4);
+// Program the DMA engine for 'req' and start it.  Each page of the
+// buffer gets a PRD entry of its own, since its pages need not be
+// physically contiguous.
+static int
+ide_dma_start(struct IdeReq *req)
+{
+	size_t n, left = req->ir_nsecs * SECTSIZE;
+	void *buf = req->ir_buf;
+	struct Prd *prd = prdt;
+	uint8_t dir = req->ir_write ? 0 : BM_CMD_READ;
+	int pa;
+
+	for (; left > 0; left -= n, buf += n, prd++) {
+		n = MIN(left, PGSIZE - PGOFF(buf));
+		if ((pa = sys_page_pa(buf)) < 0)
+			return pa;
+		prd->prd_addr = pa;
+		prd->prd_len = n;
+		prd->prd_flags = 0;
 	}
+	prd[-1].prd_flags = PRD_EOT;
 
+	outl(bmbase + BM_PRDT, prdt_pa);
+	outb(bmbase + BM_CMD, dir);
+	outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+
+	ide_start(req->ir_secno, req->ir_nsecs,
+		  req->ir_write ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+	outb(bmbase + BM_CMD, dir | BM_CMD_START);
 	return 0;
 }
 
-int
-ide_write(uint32_t secno, const void *src, size_t nsecs)
+// Has the running DMA transfer finished?  If so, stop the engine and
+// return 1 with its result in *result.
+static bool
+ide_dma_done(int *result)
 {
-	int r;
+	uint8_t st = inb(bmbase + BM_STATUS);
 
-	assert(nsecs <= 256);
+	if (!(st & (BM_STATUS_INTR | BM_STATUS_ERR)))
+		return 0;
+	outb(bmbase + BM_CMD, 0);
+	outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+	// reading the status also acknowledges the device's interrupt
+	if ((st & BM_STATUS_ERR) || ide_wait_ready(1) < 0)
+		*result = -1;
+	else
+		*result = 0;
+	return 1;
+}
 
-	ide_wait_ready(0);
+// Transfer 'req' by PIO, all at once.
+static int
+ide_pio(struct IdeReq *req)
+{
+	size_t nsecs = req->ir_nsecs;
+	void *buf = req->ir_buf;
+	int r;
 
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x30);	// CMD 0x30 means write sector
+	ide_start(req->ir_secno, nsecs,
+		  req->ir_write ? IDE_CMD_WRITE : IDE_CMD_READ);
 
-	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
+	for (; nsecs > 0; nsecs--, buf += SECTSIZE) {
 		if ((r = ide_wait_ready(1)) < 0)
 			return r;
-		outsl(0x1F0, src, SECTSIZE/4);
+		if (req->ir_write)
+			outsl(0x1F0, buf, SECTSIZE/4);
+		else
+			insl(0x1F0, buf, SECTSIZE/4);
 	}
 
 	return 0;
 }
 
+// Disk requests wait here and run one at a time, in order.
+static struct IdeReq *ide_queue;
+static struct IdeReq **ide_queue_tail = &ide_queue;
+static bool ide_busy;		// ide_queue's head is on the disk
+
+// Take the head request off the queue with result 'r', and tell its
+// owner.
+static void
+ide_complete(int r)
+{
+	struct IdeReq *req = ide_queue;
+
+	if ((ide_queue = req->ir_next) == NULL)
+		ide_queue_tail = &ide_queue;
+	ide_busy = 0;
+	req->ir_result = r;
+	if (req->ir_done)
+		req->ir_done(req);
+}
+
+// Start the request at the head of the queue, if the disk is idle.
+// Without DMA requests complete right here, one after another.
+static void
+ide_kick(void)
+{
+	int r;
+
+	while (ide_queue && !ide_busy) {
+		if (!bmbase) {
+			ide_complete(ide_pio(ide_queue));
+		} else if ((r = ide_dma_start(ide_queue)) < 0) {
+			ide_complete(r);
+		} else {
+			ide_busy = 1;
+		}
+	}
+}
+
+// Queue 'req' for the disk.  Its ir_done, if any, is called once it has
+// finished, from ide_poll() or right away.
+void
+ide_submit(struct IdeReq *req)
+{
+	assert(req->ir_nsecs > 0 && req->ir_nsecs <= 256);
+
+	req->ir_result = 1;
+	req->ir_next = NULL;
+	*ide_queue_tail = req;
+	ide_queue_tail = &req->ir_next;
+	ide_kick();
+}
+
+// Finish the running request if the disk is done with it, and start
+// the next.  The server calls this when the kernel says the disk
+// interrupted.
+void
+ide_poll(void)
+{
+	int r;
+
+	if (ide_busy && ide_dma_done(&r))
+		ide_complete(r);
+	ide_kick();
+}
+
+// Wait for 'req' to finish; returns its result.  Other requests keep
+// completing meanwhile.  Sleeps in the kernel until the disk
+// interrupts, taking no client requests in the meantime.
+int
+ide_wait(struct IdeReq *req)
+{
+	int r;
+
+	while (ide_poll(), req->ir_result > 0)
+		if ((r = sys_notify_wait()) < 0)
+			panic("sys_notify_wait: %e", r);
+	return req->ir_result;
+}
+
+static int
+ide_rw(uint32_t secno, void *buf, size_t nsecs, bool write)
+{
+	struct IdeReq req;
+
+	req.ir_secno = secno;
+	req.ir_buf = buf;
+	req.ir_nsecs = nsecs;
+	req.ir_write = write;
+	req.ir_done = NULL;
+	ide_submit(&req);
+	return ide_wait(&req);
+}
+
+int
+ide_read(uint32_t secno, void *dst, size_t nsecs)
+{
+	return ide_rw(secno, dst, nsecs, 0);
+}
+
+int
+ide_write(uint32_t secno, const void *src, size_t nsecs)
+{
+	return ide_rw(secno, (void *) src, nsecs, 1);
+}
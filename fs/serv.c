@@ -5,6 +5,7 @@
 
 #include <inc/x86.h>
 #include <inc/string.h>
+#include <inc/setjmp.h>
 
 #include "fs.h"
 
@@ -45,8 +46,18 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
-// Virtual address at which to receive page mappings containing client requests.
-union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// Virtual address at which to receive page mappings containing client
+// requests.  The data pages of a read or write request, if any, are
+// mapped right after it, up to DISKMAP.
+union Fsipc *fsreq = (union Fsipc *)(0x0ffff000 - FSREQ_MAXPAGES * PGSIZE);
+#define fsdata ((char *) fsreq + PGSIZE)
+
+// Number of data pages received at fsdata with the current request.
+static unsigned fsdata_npages;
+
+// Set once the request being served has changed the server's state;
+// from then on it must not be parked and run again (see serve_defer).
+static bool serving_committed;
 
 void
 serve_init(void)
@@ -74,6 +85,7 @@ openfile_alloc(struct OpenFile **o)
 				return r;
 			/* fall through */
 		case 1:
+			serving_committed = 1;
 			opentab[i].o_fileid += MAXOPEN;
 			*o = &opentab[i];
 			memset(opentab[i].o_fd, 0, PGSIZE);
@@ -116,15 +128,9 @@ serve_open(envid_t envid, struct Fsreq_open *req,
 	memmove(path, req->req_path, MAXPATHLEN);
 	path[MAXPATHLEN-1] = 0;
 
-	// Find an open file ID
-	if ((r = openfile_alloc(&o)) < 0) {
-		if (debug)
-			cprintf("openfile_alloc failed: %e", r);
-		return r;
-	}
-	fileid = r;
-
-	// Open the file
+	// Open the file.  This may fault on the block cache, so it
+	// comes before anything that changes the server's state (see
+	// serve_argsize).
 	if (req->req_omode & O_CREAT) {
 		if ((r = file_create(path, &f)) < 0) {
 			if (!(req->req_omode & O_EXCL) && r == -E_FILE_EXISTS)
@@ -156,6 +162,14 @@ try_open:
 		return r;
 	}
 
+	// Find an open file ID
+	if ((r = openfile_alloc(&o)) < 0) {
+		if (debug)
+			cprintf("openfile_alloc failed: %e", r);
+		return r;
+	}
+	fileid = r;
+
 	// Save the file pointer
 	o->o_file = f;
 
@@ -202,8 +216,9 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req)
 
 // Read at most ipc->read.req_n bytes from the current seek position
 // in ipc->read.req_fileid.  Return the bytes read from the file to
-// the caller in ipc->readRet, then update the seek position.  Returns
-// the number of bytes successfully read, or < 0 on error.
+// the caller in the data pages, or in ipc->readRet if none were sent,
+// then update the seek position.  Returns the number of bytes
+// successfully read, or < 0 on error.
 int
 serve_read(envid_t envid, union Fsipc *ipc)
 {
@@ -219,8 +234,16 @@ serve_read(envid_t envid, union Fsipc *ipc)
     if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
         return r;
 
-    if ((r = file_read(o->o_file, ret->ret_buf, req->req_n, o->o_fd->fd_offset)) < 0)
+    char *buf = ret->ret_buf;
+    size_t n = MIN(req->req_n, PGSIZE);
+    if (fsdata_npages) {
+        buf = fsdata;
+        n = MIN(req->req_n, fsdata_npages * PGSIZE);
+    }
+
+    if ((r = file_read(o->o_file, buf, n, o->o_fd->fd_offset)) < 0)
         return r;
+    serving_committed = 1;
     o->o_fd->fd_offset += r;
 
 	return r;
@@ -243,7 +266,14 @@ serve_write(envid_t envid, struct Fsreq_write *req)
     if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
         return r;
 
-    if ((r = file_write(o->o_file, req->req_buf, req->req_n, o->o_fd->fd_offset)) < 0)
+    const char *buf = req->req_buf;
+    size_t n = MIN(req->req_n, sizeof(req->req_buf));
+    if (fsdata_npages) {
+        buf = fsdata;
+        n = MIN(req->req_n, fsdata_npages * PGSIZE);
+    }
+
+    if ((r = file_write(o->o_file, buf, n, o->o_fd->fd_offset)) < 0)
         return r;
     o->o_fd->fd_offset += r;;
 
@@ -309,28 +339,251 @@ fshandler handlers[] = {
 	[FSREQ_SYNC] =		serve_sync
 };
 
+// A request that misses in the block cache is parked, if it can be run
+// again from the start, until its block has been read; meanwhile the
+// server goes on with other requests.  A parked request's pages are
+// moved aside to SERVDEFER, and put back at fsreq to run it again.
+struct Parked {
+	bool p_busy;
+	bool p_ready;		// Its block has arrived
+	uint32_t p_blockno;
+	envid_t p_whom;
+	uint32_t p_req;
+	int p_perm;
+	unsigned p_npages;	// Data pages after the request page
+};
+
+#define NPARKED		8
+#define PARKVA(p)	((char *) SERVDEFER + \
+			 ((p) - parked) * (1 + FSREQ_MAXPAGES) * PGSIZE)
+
+static struct Parked parked[NPARKED];
+
+// The request being served, how much of its arguments to keep (0 if it
+// cannot be parked), and where to go when it is parked.
+static struct Parked serving;
+static size_t serving_argsize;
+static char serving_args[sizeof(struct Fsreq_open)];
+static struct JmpBuf serve_restart;
+
+// If request 'req' may be run again from the start after a cache miss,
+// return the size of its arguments, which its own reply may overwrite
+// before the miss; otherwise 0.
+//
+// Parking abandons the handler where it faulted, so only a handler
+// that changes nothing before its last block cache access may be
+// listed here: serve_read updates the seek position only after
+// file_read, serve_stat only writes its reply, and serve_open without
+// O_CREAT or O_TRUNC looks the file up before openfile_alloc.  Those
+// first changes set serving_committed, which serve_defer asserts is
+// still clear.
+static size_t
+serve_argsize(uint32_t req, union Fsipc *ipc)
+{
+	switch (req) {
+	case FSREQ_READ:
+		return sizeof(struct Fsreq_read);
+	case FSREQ_STAT:
+		return sizeof(struct Fsreq_stat);
+	case FSREQ_OPEN:
+		if (ipc->open.req_omode & (O_CREAT | O_TRUNC))
+			return 0;
+		return sizeof(struct Fsreq_open);
+	default:
+		return 0;
+	}
+}
+
+// Called by the block cache on a miss on 'blockno' that is being read.
+// If the request being served can be parked, park it and go back to
+// the server loop; otherwise return, and the caller waits.
+//
+// The miss is handled in bc_pgfault, on the exception stack, so the
+// longjmp leaves the page fault upcall's frame behind.  That is fine:
+// nothing on it is needed again, and the next fault starts at the top
+// of the exception stack since we are no longer running on it.
+void
+serve_defer(uint32_t blockno)
+{
+	struct Parked *p;
+	char *va;
+	unsigned i;
+	int r;
+
+	if (!serving_argsize)
+		return;
+	assert(!serving_committed);
+	for (p = parked; p < parked + NPARKED && p->p_busy; p++)
+		;
+	if (p == parked + NPARKED)
+		return;
+
+	memmove(fsreq, serving_args, serving_argsize);
+	for (i = 0; i < 1 + serving.p_npages; i++) {
+		va = (char *) fsreq + i * PGSIZE;
+		if ((r = batch_page_map(0, va, 0, PARKVA(p) + i * PGSIZE,
+					uvpt[PGNUM(va)] & PTE_SYSCALL)) < 0)
+			panic("batch_page_map: %e", r);
+	}
+	if ((r = batch_flush()) < 0)
+		panic("serve_defer: %e", r);
+
+	*p = serving;
+	p->p_busy = 1;
+	p->p_ready = 0;
+	p->p_blockno = blockno;
+	serving_argsize = 0;
+	longjmp(&serve_restart, 1);
+}
+
+// Block 'blockno' is in the cache now: its requests can run again.
+void
+serve_wake(uint32_t blockno)
+{
+	struct Parked *p;
+
+	for (p = parked; p < parked + NPARKED; p++)
+		if (p->p_busy && p->p_blockno == blockno)
+			p->p_ready = 1;
+}
+
+// Take a parked request whose block has arrived, if any, and put its
+// pages back at fsreq.
+static struct Parked *
+serve_unpark(void)
+{
+	struct Parked *p;
+	char *va;
+	unsigned i;
+	int r;
+
+	for (p = parked; p < parked + NPARKED; p++)
+		if (p->p_busy && p->p_ready)
+			break;
+	if (p == parked + NPARKED)
+		return NULL;
+
+	for (i = 0; i < 1 + p->p_npages; i++) {
+		va = PARKVA(p) + i * PGSIZE;
+		if ((r = batch_page_map(0, va, 0, (char *) fsreq + i * PGSIZE,
+					uvpt[PGNUM(va)] & PTE_SYSCALL)) < 0
+		    || (r = batch_page_unmap(0, va)) < 0)
+			panic("serve_unpark: %e", r);
+	}
+	if ((r = batch_flush()) < 0)
+		panic("serve_unpark: %e", r);
+	p->p_busy = 0;
+	return p;
+}
+
+// Answer 'whom', which is blocked in ipc_call waiting for us, without
+// waiting for the next request.  If it is gone, never mind; if it
+// refuses the page, answer with the error alone.
+static void
+serve_reply(envid_t whom, uint32_t val, void *pg, int perm)
+{
+	int r;
+
+	while ((r = sys_ipc_try_send(whom, val, pg ? pg : (void *) UTOP,
+				     perm)) == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r < 0 && r != -E_BAD_ENV) {
+		cprintf("fs: reply to %08x failed: %e\n", whom, r);
+		if (pg)
+			serve_reply(whom, r, NULL, 0);
+	}
+}
+
 void
 serve(void)
 {
 	uint32_t req, whom;
 	int perm, r;
+	unsigned npages;
 	void *pg;
+	envid_t reply_to = 0;
+	IPC_VEC(1) reply;
+	struct Parked *p;
 
+	r = 0;
+	pg = NULL;
+	perm = 0;
 	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
-		if (debug)
-			cprintf("fs req %d from %08x [page %08x: %s]\n",
-				req, whom, uvpt[PGNUM(fsreq)], fsreq);
-
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
-			cprintf("Invalid request from %08x: no argument page\n",
-				whom);
-			continue; // just leave it hanging...
+		if ((p = serve_unpark()) != NULL) {
+			// A parked request can go on.  Answer the last
+			// request by itself first.
+			if (reply_to)
+				serve_reply(reply_to, r, pg, perm);
+			reply_to = 0;
+			whom = p->p_whom;
+			req = p->p_req;
+			perm = p->p_perm;
+			fsdata_npages = p->p_npages;
+		} else {
+			// Reply to the previous request (if any) and wait for
+			// the next one in a single system call.  The new request
+			// page and any data pages replace the old mappings at
+			// fsreq.
+			reply.v.iv_npages = pg ? 1 : 0;
+			reply.v.iv_pages[0].ip_va = pg;
+			reply.v.iv_pages[0].ip_perm = perm;
+			req = ipc_reply_waitv(reply_to, r, &reply.v,
+					      (envid_t *) &whom, fsreq,
+					      1 + FSREQ_MAXPAGES, &npages);
+			if ((int32_t) req < 0) {
+				// The reply was refused, so nothing was
+				// received either.  The client is still
+				// waiting: answer it with the error alone.
+				cprintf("fs: reply to %08x failed: %e\n",
+					reply_to, req);
+				if (!pg)
+					reply_to = 0;
+				r = req;
+				pg = NULL;
+				perm = 0;
+				continue;
+			}
+			reply_to = 0;
+
+			// A message from the kernel: the disk interrupted
+			if (whom == 0 && req == 0) {
+				ide_poll();
+				pg = NULL;
+				perm = 0;
+				continue;
+			}
+
+			perm = npages ? thisenv->env_ipc_perm : 0;
+			fsdata_npages = npages ? npages - 1 : 0;
+			if (debug)
+				cprintf("fs req %d from %08x [page %08x: %s]\n",
+					req, whom, uvpt[PGNUM(fsreq)], fsreq);
+
+			// All requests must contain an argument page
+			if (!(perm & PTE_P)) {
+				cprintf("Invalid request from %08x: no argument page\n",
+					whom);
+				pg = NULL;
+				perm = 0;
+				continue; // just leave it hanging...
+			}
 		}
 
 		pg = NULL;
+		if (setjmp(&serve_restart)) {
+			// Parked by serve_defer; nobody to answer yet
+			pg = NULL;
+			perm = 0;
+			continue;
+		}
+		serving.p_whom = whom;
+		serving.p_req = req;
+		serving.p_perm = perm;
+		serving.p_npages = fsdata_npages;
+		serving_argsize = serve_argsize(req, fsreq);
+		serving_committed = 0;
+		memmove(serving_args, fsreq, serving_argsize);
+
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
 		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
@@ -339,8 +592,8 @@ serve(void)
 			cprintf("Invalid request code %d from %08x\n", req, whom);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
+		serving_argsize = 0;
+		reply_to = whom;
 	}
 }
 
@@ -43,10 +43,57 @@ enum EnvType {
 	ENV_TYPE_USER = 0,
 	ENV_TYPE_FS,		// File system server
 	ENV_TYPE_NS,		// Network server
+	ENV_NTYPES
 };
 
+// Scatter/gather IPC: the pages sent with one sys_ipc_call or
+// sys_ipc_reply_wait.  Page i is mapped at the receiver's
+// env_ipc_dstva + i * PGSIZE.
+#define IPC_MAXPAGES		64
+
+struct IpcPage {
+	void *ip_va;			// Page-aligned VA in the sender
+	int ip_perm;			// Perm to map it with in the receiver
+};
+
+struct IpcVec {
+	unsigned iv_npages;		// Number of valid iv_pages
+	struct IpcPage iv_pages[];	// At most IPC_MAXPAGES
+};
+
+// An IpcVec with room for 'n' pages, to be used as its member v, so
+// callers only reserve what they send.
+#define IPC_VEC_SIZE(n)	(sizeof(struct IpcVec) + (n) * sizeof(struct IpcPage))
+#define IPC_VEC(n)	union { struct IpcVec v; char iv_space[IPC_VEC_SIZE(n)]; }
+
+// Scheduling priority levels of the multi-level feedback queue.
+// Level 0 is the highest.  sys_env_set_priority can pin an env at a
+// level (above the lowest only for the I/O servers), or return it to
+// feedback scheduling with ENV_PRIO_MLFQ.
+#define NPRIO			4
+#define ENV_PRIO_MLFQ		(-1)
+
+// Scheduling policies, chosen with sys_sched_set_policy.  Under
+// SCHED_POLICY_STRIDE each env gets CPU time in proportion to its
+// env_tickets (ENV_DEFAULT_TICKETS unless set with sys_env_set_tickets).
+#define SCHED_POLICY_MLFQ	0
+#define SCHED_POLICY_STRIDE	1
+#define ENV_DEFAULT_TICKETS	100
+#define ENV_MAX_TICKETS		10000
+
+// CPU affinity: bit i of env_affinity allows the env to run on CPU i.
+#define ENV_AFFINITY_ALL	0xffffffff
+
 typedef void (*Net_Intr_Handler)(bool, envid_t);
 
+// A kernel timer on the timer wheel (see kern/timer.c).
+struct Timer {
+	struct Timer *tm_next;		// Next timer in the same slot
+	struct Timer **tm_pprev;	// Link to us; NULL when not pending
+	uint32_t tm_expires;		// time_msec() at which it fires
+	void (*tm_fn)(struct Timer *);	// Called when it fires
+};
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;		// Next free Env
@@ -57,8 +104,26 @@ struct Env {
 	uint32_t env_runs;		// Number of times environment has run
 	int env_cpunum;			// The CPU that the env is running on
 
+	// Scheduling
+	int env_priority;		// MLFQ level, 0 is the highest
+	bool env_prio_pinned;		// Level fixed by sys_env_set_priority
+	unsigned env_ticks;		// Timer ticks used at this level
+	uint32_t env_affinity;		// CPUs the env may run on
+	unsigned env_tickets;		// Share under the stride policy
+	uint64_t env_pass;		// Stride pass, advanced as it runs
+	uint32_t env_pass_cycles;	// Cycles run but not yet in env_pass
+
+	struct Timer env_timer;		// Wakes the env from sys_sleep or
+					// a timed sys_ipc_recv
+
+	// CPU time accounting
+	uint64_t env_runtime;		// TSC cycles spent in user mode
+	uint64_t env_run_start;		// TSC at the last env_run
+
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
+	struct Vdso *env_vdso;		// Kernel virtual address of the
+					// page mapped at UVDSO
 
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
@@ -66,9 +131,19 @@ struct Env {
 	// Lab 4 IPC
 	bool env_ipc_recving;		// Env is blocked receiving
 	void *env_ipc_dstva;		// VA at which to map received page
+	unsigned env_ipc_dstnpages;	// Pages in the receive window
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	unsigned env_ipc_npages;	// Number of pages received
+	struct Env *env_ipc_donors;	// Callers blocked in ipc_call on us
+	struct Env *env_ipc_donee;	// Callee of our blocked ipc_call
+	struct Env *env_ipc_donor_next;	// Next donor to the same callee
+	bool env_notify_pending;	// env_notify() arrived while busy
+
+	// Console input
+	bool env_cons_waiting;		// Blocked in sys_cons_read
+	struct Env *env_cons_next;	// Next env on the console wait queue
 
     // Lab 6 Network
     Net_Intr_Handler env_net_intr_handler;
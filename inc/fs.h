@@ -63,8 +63,11 @@ struct Super {
 enum {
 	FSREQ_OPEN = 1,
 	FSREQ_SET_SIZE,
-	// Read returns a Fsret_read on the request page
+	// Read returns a Fsret_read on the request page, or the data in
+	// the data pages sent after it (see FSREQ_MAXPAGES)
 	FSREQ_READ,
+	// Write takes its data from the data pages sent after the request
+	// page, or from Fsreq_write.req_buf if there are none
 	FSREQ_WRITE,
 	// Stat returns a Fsret_stat on the request page
 	FSREQ_STAT,
@@ -73,6 +76,12 @@ enum {
 	FSREQ_SYNC
 };
 
+// Maximum number of data pages a client may send along with the request
+// page of an FSREQ_READ or FSREQ_WRITE.  The file server reads into or
+// writes from those pages directly, so one request can move up to
+// FSREQ_MAXPAGES * PGSIZE bytes.
+#define FSREQ_MAXPAGES	32
+
 union Fsipc {
 	struct Fsreq_open {
 		char req_path[MAXPATHLEN];
@@ -33,6 +33,7 @@ extern const char *binaryname;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
+extern const volatile struct Vdso vdso;
 
 // exit.c
 void	exit(void);
@@ -53,13 +54,31 @@ static envid_t sys_exofork(void);
 int	sys_env_set_status(envid_t env, int status);
 int	sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
 int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
+int	sys_env_set_priority(envid_t env, int priority);
+int	sys_env_set_affinity(envid_t env, uint32_t mask);
+int	sys_env_set_tickets(envid_t env, unsigned tickets);
+int	sys_sched_set_policy(int policy);
 int	sys_page_alloc(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_timeout(void *rcv_pg, uint32_t usec);
+int	sys_ipc_call(envid_t to_env, uint32_t value, const struct IpcVec *vec,
+		     void *rcv_pg, unsigned rcv_npages);
+int	sys_ipc_reply_wait(envid_t whom, uint32_t value, const struct IpcVec *vec,
+			   void *rcv_pg, unsigned rcv_npages);
 unsigned int sys_time_msec(void);
+int	sys_time_usec(uint64_t *usec);
+int	sys_sleep(uint32_t usec);
+int	sys_batch(struct BatchRing *ring);
+int	sys_syscall_stats(struct SyscallStat *stats, bool reset);
+int	sys_cons_log(char *buf, size_t len);
+int	sys_cons_read(char *buf, size_t len);
+int	sys_page_pa(void *va);
+int	sys_ide_dma_base(void);
+int	sys_notify_wait(void);
 int sys_send_packets(char *data, int len);
 int sys_recv_packets(char *data, int *len, bool wait);
 
@@ -74,9 +93,31 @@ sys_exofork(void)
 	return ret;
 }
 
+// batch.c
+int	batch_page_alloc(envid_t env, void *pg, int perm);
+int	batch_page_map(envid_t src_env, void *src_pg,
+		       envid_t dst_env, void *dst_pg, int perm);
+int	batch_page_unmap(envid_t env, void *pg);
+int	batch_env_set_status(envid_t env, int status);
+int	batch_env_set_pgfault_upcall(envid_t env, void *upcall);
+int	batch_flush(void);
+
+// time.c
+uint64_t	time_usec(void);
+unsigned int	time_msec(void);
+
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t	ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		 void *rcv_pg, int *perm_store);
+int32_t	ipc_reply_wait(envid_t whom, uint32_t value, void *pg, int perm,
+		       envid_t *from_env_store, void *rcv_pg, int *perm_store);
+int32_t	ipc_callv(envid_t to_env, uint32_t value, const struct IpcVec *vec,
+		  void *rcv_pg, unsigned rcv_npages, unsigned *npages_store);
+int32_t	ipc_reply_waitv(envid_t whom, uint32_t value, const struct IpcVec *vec,
+			envid_t *from_env_store, void *rcv_pg,
+			unsigned rcv_npages, unsigned *npages_store);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
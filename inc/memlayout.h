@@ -135,6 +135,12 @@
 // Used for temporary page mappings for the user page-fault handler
 // (should not conflict with other temporary page mappings)
 #define PFTEMP		(UTEMP + PTSIZE - PGSIZE)
+// The per-environment batched system call ring (struct BatchRing) lives
+// in the page below PFTEMP.  Being below UTEXT, fork does not share it.
+#define UBATCH		(PFTEMP - PGSIZE)
+// Read-only per-environment data (struct Vdso), in the page below UBATCH.
+// An integer rather than a 'void*', so lib/entry.S can use it too.
+#define UVDSO		(UTEXT - 3*PGSIZE)
 // The location of the user-level STABS data structure
 #define USTABDATA	(PTSIZE / 2)
 
@@ -187,5 +193,26 @@ struct PageInfo {
 	uint16_t pp_ref;
 };
 
+/*
+ * Clock parameters, set once by the kernel at boot.  Microseconds since
+ * boot are (tsc - ci_tsc_boot) * ci_usec_mult / 2^32.
+ */
+struct ClockInfo {
+	uint64_t ci_tsc_boot;	// TSC value at time 0
+	uint64_t ci_tsc_hz;	// TSC cycles per second
+	uint32_t ci_usec_mult;	// Microseconds per cycle, times 2^32
+};
+
+/*
+ * Per-environment data, mapped read-only at UVDSO in every environment.
+ * The kernel keeps it current, so user programs can ask who they are,
+ * what time it is and where they run without a system call.
+ */
+struct Vdso {
+	int32_t vd_envid;	// This environment's envid_t
+	int32_t vd_cpu;		// The CPU it last started running on
+	struct ClockInfo vd_clock;
+};
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
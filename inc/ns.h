@@ -22,8 +22,11 @@ enum {
 	NSREQ_CLOSE,
 	NSREQ_CONNECT,
 	NSREQ_LISTEN,
-	// Recv returns a Nsret_recv on the request page.
+	// Recv returns a Nsret_recv on the request page, or the data in
+	// the data pages sent after it (see NSREQ_MAXPAGES).
 	NSREQ_RECV,
+	// Send takes its data from the data pages sent after the request
+	// page, or from Nsreq_send.req_buf if there are none.
 	NSREQ_SEND,
 	NSREQ_SOCKET,
 
@@ -37,6 +40,11 @@ enum {
 	NSREQ_TIMER,
 };
 
+// Maximum number of data pages a client may send along with the request
+// page of an NSREQ_RECV or NSREQ_SEND; the network server receives into
+// or sends from them directly.
+#define NSREQ_MAXPAGES	8
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
@@ -0,0 +1,21 @@
+#ifndef JOS_INC_SETJMP_H
+#define JOS_INC_SETJMP_H
+
+#include <inc/types.h>
+
+// The callee-saved registers, stack pointer and resume point saved by
+// setjmp.  Longjmp may also be used to leave a page fault handler for
+// good: the exception stack frame is simply abandoned.
+struct JmpBuf {
+	uint32_t jb_eip;
+	uint32_t jb_esp;
+	uint32_t jb_ebx;
+	uint32_t jb_esi;
+	uint32_t jb_edi;
+	uint32_t jb_ebp;
+};
+
+int setjmp(struct JmpBuf *jb) __attribute__((returns_twice));
+void longjmp(struct JmpBuf *jb, int val) __attribute__((noreturn));
+
+#endif /* !JOS_INC_SETJMP_H */
@@ -1,6 +1,9 @@
 #ifndef JOS_INC_SYSCALL_H
 #define JOS_INC_SYSCALL_H
 
+#include <inc/types.h>
+#include <inc/env.h>
+
 /* system call numbers */
 enum {
 	SYS_cputs = 0,
@@ -20,7 +23,57 @@ enum {
 	SYS_time_msec,
     SYS_send_packets,
     SYS_recv_packets,
+	SYS_ipc_call,
+	SYS_ipc_reply_wait,
+	SYS_env_set_priority,
+	SYS_env_set_affinity,
+	SYS_env_set_tickets,
+	SYS_sched_set_policy,
+	SYS_time_usec,
+	SYS_sleep,
+	SYS_batch,
+	SYS_syscall_stats,
+	SYS_cons_log,
+	SYS_cons_read,
+	SYS_page_pa,
+	SYS_ide_dma_base,
+	SYS_notify_wait,
 	NSYSCALLS
 };
 
+// Statistics for one system call number (see sys_syscall_stats).
+// Everything is kept separately for each env_type of the caller.
+// Latencies are in TSC cycles: ss_hist[type][i] counts the calls that
+// took from 2^i up to 2^(i+1) cycles.  Calls that never return to the code
+// that made them (sys_yield, a blocking sys_ipc_recv, destroying
+// yourself) are counted but have no latency.
+#define SYSSTAT_NHIST	32
+
+struct SyscallStat {
+	uint64_t ss_count[ENV_NTYPES];	// Calls, by env_type of the caller
+	uint64_t ss_cycles[ENV_NTYPES];	// Total latency
+	uint32_t ss_hist[ENV_NTYPES][SYSSTAT_NHIST];
+};
+
+// Batched system calls.  An environment queues calls in a BatchRing
+// (libjos keeps one at UBATCH) and submits them all with sys_batch,
+// which runs the entries from br_tail up to br_head in order, stores
+// each result in be_ret and advances br_tail.  The kernel stops after
+// the first entry that fails.  The indices run freely; entry i lives
+// in br_ent[i % BATCH_NENT].
+#define BATCH_NENT	64
+
+struct BatchEntry {
+	uint32_t be_num;	// system call number
+	uint32_t be_args[5];
+	int32_t be_ret;		// result, once the kernel has run it
+	uint32_t be_pad;
+};
+
+struct BatchRing {
+	uint32_t br_head;	// next entry the environment fills in
+	uint32_t br_tail;	// next entry the kernel runs
+	struct BatchEntry br_ent[BATCH_NENT];
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -0,0 +1,42 @@
+#ifndef JOS_INC_TRACE_H
+#define JOS_INC_TRACE_H
+
+#include <inc/types.h>
+
+// Kernel trace events.  The kernel records them in per-CPU rings (see
+// kern/trace.c); kern/tracedec.c, a host program, decodes a dump of
+// the rings into a timeline.  Keep the two in step.
+enum {
+	TRACE_ENV_RUN = 0,	// a: envid started, b: envid it replaced
+	TRACE_SCHED_YIELD,	// a: envid giving up the CPU, or 0
+	TRACE_TRAP,		// a: trapno, b: eip, c: envid
+	TRACE_IPC_SEND,		// a: from envid, b: to envid, c: npages
+	TRACE_IPC_RECV,		// a: envid blocking, b: sender it waits for
+	TRACE_PGFAULT,		// a: fault va, b: eip, c: envid
+	TRACE_NET_INTR,		// a: interrupt causes (E1000 ICR)
+	TRACE_PAGE_ALLOC,	// a: physical address, b: alloc flags
+	TRACE_IDE_INTR,		// a: envid notified
+	NTRACE
+};
+
+// Bits for the enable mask, which selects the events recorded.
+#define TRACE_BIT(type)		(1 << (type))
+#define TRACE_ALL		(TRACE_BIT(NTRACE) - 1)
+
+struct TraceEvent {
+	uint64_t te_tsc;	// TSC when it happened
+	uint16_t te_type;	// TRACE_*
+	uint16_t te_cpu;
+	uint32_t te_a, te_b, te_c;
+};
+
+#define TRACE_NEVENTS	1024	// Per CPU; a power of 2
+
+struct TraceRing {
+	uint32_t tr_head;	// Events ever recorded; the oldest are
+	uint32_t tr_pad;	// overwritten once there are more than
+				// TRACE_NEVENTS
+	struct TraceEvent tr_events[TRACE_NEVENTS];
+};
+
+#endif /* !JOS_INC_TRACE_H */
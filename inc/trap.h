@@ -27,6 +27,7 @@
 // These are arbitrarily chosen, but with care not to overlap
 // processor defined exceptions or interrupt vectors.
 #define T_SYSCALL   48		// system call
+#define T_SYSENTER  49		// system call through sysenter (not a vector)
 #define T_DEFAULT   500		// catchall
 
 #define IRQ_OFFSET	32	// IRQ 0 corresponds to int IRQ_OFFSET
@@ -39,6 +40,7 @@
 #define IRQ_NETWORK     11
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     20	// IPI: new work for a halted CPU
 
 #ifndef __ASSEMBLER__
 
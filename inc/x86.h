@@ -3,6 +3,14 @@
 
 #include <inc/types.h>
 
+// CPUID leaf 1 EDX feature flags
+#define CPUID_FEAT_SEP		(1 << 11)	// sysenter/sysexit
+
+// Model-specific registers
+#define MSR_SYSENTER_CS		0x174
+#define MSR_SYSENTER_ESP	0x175
+#define MSR_SYSENTER_EIP	0x176
+
 static inline void
 breakpoint(void)
 {
@@ -240,6 +248,21 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 		*edxp = edx;
 }
 
+static inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+// Whether this CPU has the sysenter/sysexit fast system call.
+static inline bool
+cpu_has_sysenter(void)
+{
+	uint32_t edx;
+	cpuid(1, NULL, NULL, NULL, &edx);
+	return (edx & CPUID_FEAT_SEP) != 0;
+}
+
 static inline uint64_t
 read_tsc(void)
 {
@@ -9,9 +9,14 @@
 #include <kern/console.h>
 #include <kern/trap.h>
 #include <kern/picirq.h>
+#include <kern/ioapic.h>
+#include <kern/env.h>
+#include <kern/sched.h>
+#include <kern/work.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
+static void serial_start(void);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -33,8 +38,13 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TDI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_NOPEND 0x01	//   No interrupt pending
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE 0x01	//   Enable the 16-byte FIFOs
+#define   COM_FCR_CLEAR	0x06	//   Clear both FIFOs
+#define   COM_FIFO_SIZE	16	//   Bytes the TX FIFO holds
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -57,11 +67,18 @@ serial_proc_data(void)
 	return inb(COM1+COM_RX);
 }
 
+// Handles both receive and transmit-empty interrupts.  Loop until
+// the UART reports nothing pending, otherwise the (edge-triggered)
+// IRQ line stays high and we never hear from it again.
 void
 serial_intr(void)
 {
-	if (serial_exists)
+	if (!serial_exists)
+		return;
+	do {
 		cons_intr(serial_proc_data);
+		serial_start();
+	} while (!(inb(COM1+COM_IIR) & COM_IIR_NOPEND));
 }
 
 static void
@@ -80,8 +97,8 @@ serial_putc(int c)
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on and clear the FIFOs; output is fed 16 bytes at a time
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_CLEAR);
 
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
@@ -93,8 +110,8 @@ serial_init(void)
 
 	// No modem controls
 	outb(COM1+COM_MCR, 0);
-	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+	// Enable rcv and xmit-empty interrupts
+	outb(COM1+COM_IER, COM_IER_RDI | COM_IER_TDI);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
@@ -104,7 +121,7 @@ serial_init(void)
 
 	// Enable serial interrupts
 	if (serial_exists)
-		irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_SERIAL));
+		irq_enable(IRQ_SERIAL, IRQ_ANYCPU);
 }
 
 
@@ -185,11 +202,11 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
 		crt_buf[crt_pos++] = c;		/* write the character */
@@ -205,7 +222,11 @@ cga_putc(int c)
 			crt_buf[i] = 0x0700 | ' ';
 		crt_pos -= CRT_COLS;
 	}
+}
 
+static void
+cga_cursor(void)
+{
 	/* move that little blinky thing */
 	outb(addr_6845, 14);
 	outb(addr_6845 + 1, crt_pos >> 8);
@@ -380,7 +401,7 @@ kbd_init(void)
 {
 	// Drain the kbd buffer so that QEMU generates interrupts.
 	kbd_intr();
-	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_KBD));
+	irq_enable(IRQ_KBD, IRQ_ANYCPU);
 }
 
 
@@ -398,6 +419,12 @@ static struct {
 	uint32_t wpos;
 } cons;
 
+// Envs blocked in sys_cons_read, linked through env_cons_next.
+static struct Env *cons_waiters;
+
+static void cons_wake(struct Work *w);
+static struct Work cons_work = WORK_INIT(cons_wake);
+
 // called by device interrupt routines to feed input characters
 // into the circular console input buffer.
 static void
@@ -411,7 +438,77 @@ cons_intr(int (*proc)(void))
 		cons.buf[cons.wpos++] = c;
 		if (cons.wpos == CONSBUFSIZE)
 			cons.wpos = 0;
+		if (cons_waiters)
+			work_queue(&cons_work);
+	}
+}
+
+// Bottom half of console input: make every blocked reader runnable
+// so it can retry its read.
+static void
+cons_wake(struct Work *w)
+{
+	struct Env *e;
+
+	while ((e = cons_waiters) != NULL) {
+		cons_waiters = e->env_cons_next;
+		e->env_cons_waiting = 0;
+		if (e->env_status == ENV_NOT_RUNNABLE) {
+			e->env_status = ENV_RUNNABLE;
+			sched_wakeup(e);
+		}
+	}
+}
+
+// Queue 'e' to be woken when console input arrives.  The caller
+// blocks it.
+void
+cons_wait(struct Env *e)
+{
+	if (e->env_cons_waiting)
+		return;
+	e->env_cons_waiting = 1;
+	e->env_cons_next = cons_waiters;
+	cons_waiters = e;
+}
+
+// Take 'e' off the console wait queue, if it is on it.
+void
+cons_cancel(struct Env *e)
+{
+	struct Env **pp;
+
+	if (!e->env_cons_waiting)
+		return;
+	for (pp = &cons_waiters; *pp; pp = &(*pp)->env_cons_next)
+		if (*pp == e) {
+			*pp = e->env_cons_next;
+			break;
+		}
+	e->env_cons_waiting = 0;
+}
+
+// Move up to 'len' waiting input characters into buf without
+// blocking.  Stops after a ctl-d, which ends the read as EOF, so the
+// input typed after it stays queued for the next read.  Returns the
+// number moved.
+size_t
+cons_read(char *buf, size_t len)
+{
+	size_t n = 0;
+
+	// poll, in case an interrupt was lost (see cons_getc)
+	serial_intr();
+	kbd_intr();
+
+	while (n < len && cons.rpos != cons.wpos) {
+		buf[n] = cons.buf[cons.rpos++];
+		if (cons.rpos == CONSBUFSIZE)
+			cons.rpos = 0;
+		if (buf[n++] == 0x04)	// ctl-d
+			break;
 	}
+	return n;
 }
 
 // return the next input character from the console, or 0 if none waiting
@@ -436,13 +533,110 @@ cons_getc(void)
 	return 0;
 }
 
+/***** Kernel log ring *****/
+
+// All console output is appended to klog and drained from there: the
+// UART is fed from its transmit-empty interrupt, the display and the
+// parallel port are updated in bulk by cons_flush().  Positions count
+// bytes ever written.  The serial line is the console of record, so a
+// writer that would overrun bytes the UART has not sent yet waits for
+// them to go out (see cons_putc); the display just skips what it fell
+// more than KLOGSIZE behind on.  Writers are serialized by the big
+// kernel lock; the only unlocked ones are the boot path and panic,
+// which run in sync mode anyway.
+static struct {
+	uint8_t buf[KLOGSIZE];
+	uint32_t wpos;		// bytes ever written
+	uint32_t serial_pos;	// next byte for the UART
+	uint32_t lpt_pos;	// next byte for the parallel port
+	uint32_t cga_pos;	// next byte for the display
+} klog;
+
+// In sync mode cons_flush() busy-waits until every device has caught
+// up, as the console always did.  Used while interrupts are not being
+// taken: during boot, in the monitor and on panic.
+static bool cons_sync = 1;
+
+static int
+klog_next(uint32_t *pos)
+{
+	if (klog.wpos - *pos > KLOGSIZE)
+		*pos = klog.wpos - KLOGSIZE;
+	return klog.buf[(*pos)++ % KLOGSIZE];
+}
+
+// Fill the UART's TX FIFO from the log if it has gone empty.
+static void
+serial_start(void)
+{
+	int i;
+
+	if (!(inb(COM1 + COM_LSR) & COM_LSR_TXRDY))
+		return;
+	for (i = 0; i < COM_FIFO_SIZE && klog.serial_pos != klog.wpos; i++)
+		outb(COM1 + COM_TX, klog_next(&klog.serial_pos));
+}
+
 // output a character to the console
 static void
 cons_putc(int c)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	// If the ring is full of unsent serial output, send the oldest
+	// byte by hand rather than overwrite it.
+	while (serial_exists && klog.wpos - klog.serial_pos >= KLOGSIZE)
+		serial_putc(klog_next(&klog.serial_pos));
+	klog.buf[klog.wpos++ % KLOGSIZE] = c;
+	if (cons_sync)
+		cons_flush();
+}
+
+// Push pending log output to the devices.  The parallel port has no
+// interrupt, so it is always written here.
+void
+cons_flush(void)
+{
+	if (klog.cga_pos != klog.wpos) {
+		while (klog.cga_pos != klog.wpos)
+			cga_putc(klog_next(&klog.cga_pos));
+		cga_cursor();
+	}
+
+	while (klog.lpt_pos != klog.wpos)
+		lpt_putc(klog_next(&klog.lpt_pos));
+
+	if (!cons_sync) {
+		if (serial_exists)
+			serial_start();
+		return;
+	}
+	while (klog.serial_pos != klog.wpos)
+		serial_putc(klog_next(&klog.serial_pos));
+}
+
+// Switch between synchronous and interrupt-driven output; returns the
+// previous mode.  Going synchronous drains whatever is still queued.
+bool
+cons_set_sync(bool sync)
+{
+	bool old = cons_sync;
+
+	cons_sync = sync;
+	cons_flush();
+	return old;
+}
+
+// Copy the most recent (up to len) bytes of console history into buf;
+// returns the number of bytes copied.
+size_t
+cons_log_read(char *buf, size_t len)
+{
+	uint32_t pos;
+	size_t n;
+
+	n = MIN(len, MIN(klog.wpos, KLOGSIZE));
+	for (pos = klog.wpos - n; pos != klog.wpos; pos++)
+		*buf++ = klog.buf[pos % KLOGSIZE];
+	return n;
 }
 
 // initialize the console devices
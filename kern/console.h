@@ -8,6 +8,8 @@
 
 #include <inc/types.h>
 
+struct Env;
+
 #define MONO_BASE	0x3B4
 #define MONO_BUF	0xB0000
 #define CGA_BASE	0x3D4
@@ -17,8 +19,16 @@
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
 
+#define KLOGSIZE	16384	// bytes of console history kept (power of 2)
+
 void cons_init(void);
 int cons_getc(void);
+void cons_flush(void);
+bool cons_set_sync(bool sync);
+size_t cons_log_read(char *buf, size_t len);
+size_t cons_read(char *buf, size_t len);
+void cons_wait(struct Env *e);
+void cons_cancel(struct Env *e);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
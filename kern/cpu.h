@@ -10,19 +10,31 @@
 // Maximum number of CPUs
 #define NCPU  8
 
-// Values of status in struct Cpu
+// Values of status in struct Cpu.  A CPU_HALTED CPU is idle in
+// sched_halt() and needs a reschedule IPI (see sched_wakeup) to notice
+// new work.
 enum {
 	CPU_UNUSED = 0,
 	CPU_STARTED,
 	CPU_HALTED,
 };
 
+struct Work;
+
 // Per-CPU state
 struct CpuInfo {
 	uint8_t cpu_id;                 // Local APIC ID; index into cpus[] below
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	uint32_t cpu_slice_start;       // time_msec() the current slice began
+	uint32_t cpu_slice_end;         // ... and when it ends, 0 if unlimited
+	volatile bool cpu_resched;      // A reschedule IPI is on its way
+	struct Work *cpu_work;          // Deferred interrupt work (kern/work.c)
+	struct Work **cpu_work_tail;    // ... and the link to append to
+	volatile bool cpu_preempt;      // Reschedule on leaving the kernel
+	uint64_t cpu_intr_off_start;    // TSC when interrupts were last disabled
+	uint64_t cpu_intr_off_max;      // Longest stretch with them disabled
 };
 
 // Initialized in mpconfig.c
@@ -42,5 +54,14 @@ void lapic_init(void);
 void lapic_startap(uint8_t apicid, uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
+void lapic_ipi_cpu(uint8_t apicid, int vector);
+
+// The LAPIC timer counts down at the bus frequency.  time_init() measures
+// it against the PIT; until then we assume QEMU's 1 GHz.
+#define LAPIC_COUNTS_PER_MS	1000000
+void lapic_timer_oneshot(uint32_t ms);
+void lapic_timer_freerun(void);
+uint32_t lapic_timer_count(void);
+void lapic_timer_calibrate(uint32_t counts_per_ms);
 
 #endif
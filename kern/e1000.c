@@ -3,7 +3,16 @@
 #include <inc/string.h>
 #include <kern/e1000.h>
 #include <kern/picirq.h>
+#include <kern/ioapic.h>
+#include <kern/cpu.h>
+#include <kern/work.h>
 #include <kern/pmap.h>
+#include <kern/trace.h>
+
+// The CPU that handles NIC interrupts; "make NIC_CPU=n" picks one.
+#ifndef NIC_CPU
+#define NIC_CPU		IRQ_LASTCPU
+#endif
 
 // LAB 6: Your driver code here
 // These constants are loosely copied from
@@ -149,7 +158,10 @@ attach_e1000(struct pci_func *pcif)
     base = pcif->reg_base[0];
     size = pcif->reg_size[0];
     uint8_t irq_line = pcif->irq_line;
-    irq_setmask_8259A(irq_mask_8259A & ~(1<<irq_line));
+    // Give the NIC a core of its own, away from the boot CPU's console
+    // and user work, when there is more than one (see NIC_CPU and
+    // nic_reserve_cpu).
+    irq_enable(irq_line, NIC_CPU);
 
     e1000_addr = mmio_map_region(base, size);
     memset((void *)base, 0, size);
@@ -227,6 +239,20 @@ attach_e1000(struct pci_func *pcif)
     return 0;
 }
 
+// Once the APs are up, keep new user envs off the CPU that takes the
+// NIC's interrupts, so that it is left to the interrupt handler and the
+// network server.  Does nothing with a single CPU or without a NIC.
+void
+nic_reserve_cpu(void)
+{
+    int cpu = NIC_CPU == IRQ_LASTCPU ? ncpu - 1 : NIC_CPU;
+
+    if (!e1000_addr || ncpu < 2 || ncpu > 32 || cpu < 0 || cpu >= ncpu)
+        return;
+    env_default_affinity = ((ncpu == 32 ? 0 : 1U << ncpu) - 1)
+        & ~(1U << cpus[cpu].cpu_id);
+}
+
 int
 transmit_packets(char *data, int len, envid_t id)
 {
@@ -286,34 +312,53 @@ receive_packets(char *data, int *len, envid_t id, bool wait)
     return 0;
 }
 
-// Kind of awkward place
+// Interrupt causes network_intr has acknowledged but net_work has not
+// yet handled.
+static uint32_t net_pending;
+
+static void net_bottom_half(struct Work *w);
+static struct Work net_work = WORK_INIT(net_bottom_half);
+
+// Top half of the NIC interrupt: acknowledge the causes we care about
+// and leave the rest to net_bottom_half.
 void
 network_intr()
 {
-    uint32_t tail_index = e1000_addr[RADDR(E1000_RDT)];
-    uint32_t head_index = e1000_addr[RADDR(E1000_RDH)];
-    tail_index %= R_N;
-
-    uint32_t icr = e1000_addr[RADDR(E1000_ICR)];
-    bool is_write = (icr & E1000_ICR_TXDW) &&
-        (e1000_addr[RADDR(E1000_IMS)] & E1000_IMS_TXDW);
-    bool is_read = (icr & E1000_ICR_RXT0) &&
-        (e1000_addr[RADDR(E1000_IMS)] & E1000_IMS_RXT0);
-
-    int r;
-    struct Env *e = NULL;
-    if (is_read && !is_write) {
-        envid2env(receiver_id, &e, false);
-        e1000_addr[RADDR(E1000_ICR)] = E1000_ICR_RXT0;
-    } else if (is_write && !is_read) {
-        envid2env(sender_id, &e, false);
-        e1000_addr[RADDR(E1000_ICR)] = E1000_ICR_TXDW;
-    } else {
-        panic("Bad interrupt");
-    }
+    uint32_t icr = e1000_addr[RADDR(E1000_ICR)] & e1000_addr[RADDR(E1000_IMS)];
+
+    icr &= E1000_ICR_TXDW | E1000_ICR_RXT0;
+    e1000_addr[RADDR(E1000_ICR)] = icr;
+    TRACE(TRACE_NET_INTR, icr, 0, 0);
+    net_pending |= icr;
+    if (net_pending)
+        work_queue(&net_work);
+}
+
+// Call the handler of the env blocked in sys_send_packets or
+// sys_recv_packets, if it is still waiting.
+static void
+net_wake(envid_t id, bool is_read)
+{
+    struct Env *e;
+    Net_Intr_Handler handler;
 
-    if (e == NULL || e->env_net_intr_handler == 0)
+    if (envid2env(id, &e, false) < 0 || e->env_net_intr_handler == 0)
         return;
-    e->env_net_intr_handler(is_read, e->env_id);
+    handler = e->env_net_intr_handler;
+    e->env_net_intr_handler = 0;
+    handler(is_read, e->env_id);
+}
+
+// Bottom half of the NIC interrupt: wake the senders and receivers.
+static void
+net_bottom_half(struct Work *w)
+{
+    uint32_t causes = net_pending;
+
+    net_pending = 0;
+    if (causes & E1000_ICR_RXT0)
+        net_wake(receiver_id, 1);
+    if (causes & E1000_ICR_TXDW)
+        net_wake(sender_id, 0);
 }
 
@@ -5,6 +5,7 @@
 #include <kern/pci.h>
 
 int attach_e1000(struct pci_func *pcif);
+void nic_reserve_cpu(void);
 void network_intr();
 int transmit_packets(char *, int, envid_t);
 int receive_packets(char *, int*, envid_t, bool);
@@ -14,9 +14,15 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/timer.h>
+#include <kern/time.h>
+#include <kern/trace.h>
+#include <kern/console.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
+// CPUs a new env may run on; nic_reserve_cpu takes the NIC's CPU out.
+uint32_t env_default_affinity = ENV_AFFINITY_ALL;
 					// (linked by Env->env_link)
 
 #define ENVGENSHIFT	12		// >= LOGNENV
@@ -167,7 +173,7 @@ static int
 env_setup_vm(struct Env *e)
 {
 	int i;
-	struct PageInfo *p = NULL;
+	struct PageInfo *p = NULL, *vp = NULL;
 
 	// Allocate a page for the page directory
 	if (!(p = page_alloc(ALLOC_ZERO)))
@@ -197,6 +203,20 @@ env_setup_vm(struct Env *e)
 	// UVPT maps the env's own page table read-only.
 	// Permissions: kernel R, user R
 	e->env_pgdir[PDX(UVPT)] = PADDR(e->env_pgdir) | PTE_P | PTE_U;
+
+	// The vDSO page at UVDSO, kernel RW, user R.  env_free frees it
+	// along with the rest of the user address space.
+	if (!(vp = page_alloc(ALLOC_ZERO))
+	    || page_insert(e->env_pgdir, vp, (void *) UVDSO, PTE_P | PTE_U) < 0) {
+		// page_insert fails before it allocates a page table
+		if (vp)
+			page_free(vp);
+		e->env_pgdir = 0;
+		page_decref(p);
+		return -E_NO_MEM;
+	}
+	e->env_vdso = page2kva(vp);
+	e->env_vdso->vd_clock = clockinfo;
 	return 0;
 }
 
@@ -227,6 +247,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	if (generation <= 0)	// Don't create a negative env_id.
 		generation = 1 << ENVGENSHIFT;
 	e->env_id = generation | (e - envs);
+	e->env_vdso->vd_envid = e->env_id;
 
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
@@ -264,6 +285,22 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_ipc_donors = NULL;
+	e->env_ipc_donee = NULL;
+	e->env_notify_pending = 0;
+	e->env_cons_waiting = 0;
+
+	// New envs start at the top MLFQ level, with a default share.
+	e->env_priority = 0;
+	e->env_prio_pinned = 0;
+	e->env_ticks = 0;
+	e->env_runtime = 0;
+	sched_init_env(e);
+
+	// It may run on any CPU not set aside for a device, and has not
+	// run on one yet.
+	e->env_affinity = env_default_affinity;
+	e->env_cpunum = -1;
 
 	// commit the allocation
 	env_free_list = e->env_link;
@@ -293,7 +330,10 @@ region_alloc(struct Env *e, void *va, size_t len)
     uintptr_t *addr = (uintptr_t *)ROUNDDOWN(va, PGSIZE);
     uintptr_t *addr_end = (uintptr_t *)ROUNDUP(va + len, PGSIZE);
     for (; addr < addr_end; addr += PGSIZE / sizeof (uintptr_t *)) {
-        struct PageInfo *pp = page_alloc(ALLOC_ZERO);
+        struct PageInfo *pp;
+
+        intr_window();
+        pp = page_alloc(ALLOC_ZERO);
         if (pp == NULL)
             panic("Allocation fails");
 
@@ -405,6 +445,13 @@ env_create(uint8_t *binary, enum EnvType type)
 	// LAB 5: Your code here.
     if (type == ENV_TYPE_FS)
         e->env_tf.tf_eflags |= FL_IOPL_3;
+
+    // Keep the I/O servers responsive however many CPU hogs there are,
+    // and let them (and the ns helpers they fork) use every CPU.
+    if (type == ENV_TYPE_FS || type == ENV_TYPE_NS) {
+        e->env_prio_pinned = 1;
+        e->env_affinity = ENV_AFFINITY_ALL;
+    }
 }
 
 //
@@ -426,9 +473,18 @@ env_free(struct Env *e)
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
+	// Withdraw e's donation to the callee of its ipc_call, and the
+	// donations of the callers blocked on e.
+	sched_donation_free(e);
+
+	timer_cancel(&e->env_timer);
+	cons_cancel(e);
+
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
 	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+		// a page table is a lot of work; let interrupts in first
+		intr_window();
 
 		// only look at mapped page tables
 		if (!(e->env_pgdir[pdeno] & PTE_P))
@@ -496,6 +552,30 @@ env_pop_tf(struct Trapframe *tf)
 {
 	// Record the CPU we are running on for user-space debugging
 	curenv->env_cpunum = cpunum();
+	curenv->env_vdso->vd_cpu = curenv->env_cpunum;
+	intr_off_end();
+
+	// An env that entered through sysenter is in the middle of a
+	// system call stub that expects %ecx and %edx to be clobbered, so
+	// it can leave through the much cheaper sysexit, which resumes at
+	// %edx with its stack at %ecx.  sysexit leaves EFLAGS alone, so
+	// load the env's own flags (its IOPL in particular) first, with
+	// IF still clear; sti takes effect only after sysexit, so no
+	// interrupt can arrive on the kernel stack.
+	if (tf->tf_trapno == T_SYSENTER)
+		asm volatile(
+			"\tmovl %0,%%esp\n"
+			"\tpopal\n"
+			"\tpopl %%es\n"
+			"\tpopl %%ds\n"
+			"\tpushl 0x10(%%esp)\n"      /* tf_eflags */
+			"\tandl %1,(%%esp)\n"
+			"\tpopfl\n"
+			"\tmovl 0x8(%%esp),%%edx\n"  /* tf_eip */
+			"\tmovl 0x14(%%esp),%%ecx\n" /* tf_esp */
+			"\tsti\n"
+			"\tsysexit\n"
+			: : "g" (tf), "i" (~FL_IF) : "memory");
 
 	asm volatile(
 		"\tmovl %0,%%esp\n"
@@ -535,6 +615,7 @@ env_run(struct Env *e)
 	//	e->env_tf to sensible values.
 
 	// LAB 3: Your code here.
+    TRACE(TRACE_ENV_RUN, e->env_id, curenv ? curenv->env_id : 0, 0);
     if (curenv != NULL && curenv->env_status == ENV_RUNNING) {
         curenv->env_status = ENV_RUNNABLE;
     }
@@ -545,6 +626,17 @@ env_run(struct Env *e)
     assert(curenv->env_pgdir != NULL);
     lcr3(PADDR(curenv->env_pgdir));
 
+    // start the clock for CPU time accounting; see sched_charge
+    curenv->env_run_start = read_tsc();
+
+    // Interrupts taken at an intr_window may have left work or a
+    // reschedule for this CPU that nobody has seen to on the way here.
+    // Have e take a reschedule IPI as soon as it resumes.
+    if ((thiscpu->cpu_work || thiscpu->cpu_preempt) && !thiscpu->cpu_resched) {
+        thiscpu->cpu_resched = 1;
+        lapic_ipi_cpu(thiscpu->cpu_id, IRQ_OFFSET + IRQ_RESCHED);
+    }
+
     unlock_kernel();
     env_pop_tf(&curenv->env_tf);
     panic("should not be reached");
@@ -7,6 +7,7 @@
 #include <kern/cpu.h>
 
 extern struct Env *envs;		// All environments
+extern uint32_t env_default_affinity;	// CPUs new user envs may run on
 #define curenv (thiscpu->cpu_env)		// Current environment
 extern struct Segdesc gdt[];
 
@@ -0,0 +1,74 @@
+// PCI IDE controller.  The file system environment drives the disks
+// itself through I/O ports; the kernel finds the controller's
+// bus-master DMA registers (PIIX style, BAR 4), tells it where they
+// are, and passes the disk's completion interrupts on to it.
+
+#include <inc/stdio.h>
+#include <inc/error.h>
+
+#include <kern/ide.h>
+#include <kern/pcireg.h>
+#include <kern/env.h>
+#include <kern/ioapic.h>
+#include <kern/syscall.h>
+#include <kern/trace.h>
+#include <kern/work.h>
+
+// I/O port base of the bus-master registers, or 0 if there are none
+static uint32_t ide_bmbase;
+
+// The environment driving the disk, which hears of its interrupts
+static envid_t ide_owner;
+
+static void ide_bottom_half(struct Work *w);
+static struct Work ide_work = WORK_INIT(ide_bottom_half);
+
+int
+attach_ide(struct pci_func *pcif)
+{
+	// Programming interface bit 7: the controller can bus-master
+	if (!(PCI_INTERFACE(pcif->dev_class) & 0x80))
+		return 0;
+
+	pci_func_enable(pcif);
+	if (!pcif->reg_base[4])
+		return 0;
+
+	ide_bmbase = pcif->reg_base[4];
+	cprintf("IDE: bus-master DMA at port 0x%x\n", ide_bmbase);
+	// The primary channel is wired to the legacy IRQ
+	irq_enable(IRQ_IDE, IRQ_ANYCPU);
+	return 1;
+}
+
+// Returns the I/O port base of the bus-master registers, or
+// -E_NOT_SUPP if the controller cannot do DMA.  Disk interrupts go to
+// 'owner' from now on.
+int
+ide_dma_base(envid_t owner)
+{
+	if (!ide_bmbase)
+		return -E_NOT_SUPP;
+	ide_owner = owner;
+	return ide_bmbase;
+}
+
+// The disk finished a command.  The device keeps its interrupt line
+// up until the owner reads its status, so there is nothing to
+// acknowledge here.
+void
+ide_intr(void)
+{
+	TRACE(TRACE_IDE_INTR, ide_owner, 0, 0);
+	work_queue(&ide_work);
+}
+
+// Bottom half of the disk interrupt: notify the owner.
+static void
+ide_bottom_half(struct Work *w)
+{
+	struct Env *e;
+
+	if (ide_owner && envid2env(ide_owner, &e, 0) == 0)
+		env_notify(e);
+}
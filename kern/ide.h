@@ -0,0 +1,11 @@
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+
+#include <inc/env.h>
+#include <kern/pci.h>
+
+int attach_ide(struct pci_func *pcif);
+int ide_dma_base(envid_t owner);
+void ide_intr(void);
+
+#endif	// JOS_KERN_IDE_H
@@ -1,6 +1,7 @@
 /* See COPYRIGHT for copyright information. */
 
 #include <inc/stdio.h>
+#include <inc/x86.h>
 #include <inc/string.h>
 #include <inc/assert.h>
 
@@ -12,12 +13,16 @@
 #include <kern/trap.h>
 #include <kern/sched.h>
 #include <kern/picirq.h>
+#include <kern/ioapic.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/e1000.h>
 
 static void boot_aps(void);
+static void boot_mark(const char *what);
+static void boot_report(void);
 
 
 void
@@ -29,19 +34,23 @@ i386_init(void)
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
 	memset(edata, 0, end - edata);
+	boot_mark("entry");
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boot_mark("console");
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
 	// Lab 2 memory management initialization functions
 	mem_init();
+	boot_mark("memory");
 
 	// Lab 3 user environment initialization functions
 	env_init();
 	trap_init();
+	boot_mark("envs/traps");
 
 	// Lab 4 multiprocessor initialization functions
 	mp_init();
@@ -49,10 +58,14 @@ i386_init(void)
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
+	ioapic_init();
+	boot_mark("mp/irqs");
 
 	// Lab 6 hardware initialization functions
 	time_init();
+	boot_mark("clock");
 	pci_init();
+	boot_mark("pci");
 
 	// Acquire the big kernel lock before waking up APs
 	// Your code here:
@@ -60,6 +73,9 @@ i386_init(void)
 
 	// Starting non-boot CPUs
 	boot_aps();
+	irq_reroute();
+	nic_reserve_cpu();
+	boot_mark("aps");
 
 	// Start fs.
     ENV_CREATE(fs_fs, ENV_TYPE_FS);
@@ -77,17 +93,59 @@ i386_init(void)
 	ENV_CREATE(user_idle, ENV_TYPE_USER);
 #endif // TEST*
 
+	boot_mark("user envs");
+
 	// Should not be necessary - drains keyboard because interrupt has given up.
 	kbd_intr();
 
+	boot_report();
+
+	// From here on console output drains from the serial interrupt.
+	cons_set_sync(0);
+
 	// Schedule and run the first user environment!
 	sched_yield();
 }
 
-// While boot_aps is booting a given CPU, it communicates the per-core
-// stack pointer that should be loaded by mpentry.S to that CPU in
-// this variable.
-void *mpentry_kstack;
+// Boot timeline: boot_mark() stamps the end of each stage of
+// i386_init with the TSC; boot_report() prints them once the TSC
+// rate is known.
+#define NBOOTMARK	16
+
+static struct {
+	const char *bm_what;
+	uint64_t bm_tsc;
+} boot_marks[NBOOTMARK];
+static int nboot_marks;
+
+static void
+boot_mark(const char *what)
+{
+	if (nboot_marks == NBOOTMARK)
+		return;
+	boot_marks[nboot_marks].bm_what = what;
+	boot_marks[nboot_marks].bm_tsc = read_tsc();
+	nboot_marks++;
+}
+
+static uint64_t
+boot_usec(uint64_t tsc)
+{
+	return tsc / (clockinfo.ci_tsc_hz / 1000000);
+}
+
+static void
+boot_report(void)
+{
+	uint64_t t0 = boot_marks[0].bm_tsc;
+	int i;
+
+	cprintf("boot: kernel entered %llu us after reset\n", boot_usec(t0));
+	for (i = 1; i < nboot_marks; i++)
+		cprintf("boot: %-10s %8llu us (+%llu)\n", boot_marks[i].bm_what,
+			boot_usec(boot_marks[i].bm_tsc - t0),
+			boot_usec(boot_marks[i].bm_tsc - boot_marks[i-1].bm_tsc));
+}
 
 // Start the non-boot (AP) processors.
 static void
@@ -101,19 +159,16 @@ boot_aps(void)
 	code = KADDR(MPENTRY_PADDR);
 	memmove(code, mpentry_start, mpentry_end - mpentry_start);
 
-	// Boot each AP one at a time
-	for (c = cpus; c < cpus + ncpu; c++) {
-		if (c == cpus + cpunum())  // We've started already.
-			continue;
-
-		// Tell mpentry.S what stack to use 
-		mpentry_kstack = percpu_kstacks[c - cpus] + KSTKSIZE;
-		// Start the CPU at mpentry_start
-		lapic_startap(c->cpu_id, PADDR(code));
-		// Wait for the CPU to finish some basic setup in mp_main()
-		while(c->cpu_status != CPU_STARTED)
+	// Start all the APs at mpentry_start at once; mpentry.S picks
+	// each one's stack.
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c != cpus + cpunum())  // We've started already.
+			lapic_startap(c->cpu_id, PADDR(code));
+
+	// Wait for them to finish some basic setup in mp_main()
+	for (c = cpus; c < cpus + ncpu; c++)
+		while (c != cpus + cpunum() && c->cpu_status != CPU_STARTED)
 			;
-	}
 }
 
 // Setup code for APs
@@ -122,7 +177,6 @@ mp_main(void)
 {
 	// We are in high EIP now, safe to switch to kern_pgdir 
 	lcr3(PADDR(kern_pgdir));
-	cprintf("SMP: CPU %d starting\n", cpunum());
 
 	lapic_init();
 	env_init_percpu();
@@ -135,6 +189,8 @@ mp_main(void)
 	//
 	// Your code here:
     lock_kernel();
+	// The console is not safe to use before we hold the lock.
+	cprintf("SMP: CPU %d starting\n", cpunum());
     sched_yield();
 }
 
@@ -159,6 +215,7 @@ _panic(const char *file, int line, const char *fmt,...)
 
 	// Be extra sure that the machine is in as reasonable state
 	asm volatile("cli; cld");
+	cons_set_sync(1);
 
 	va_start(ap, fmt);
 	cprintf("kernel panic on CPU %d at %s:%d: ", cpunum(), file, line);
@@ -0,0 +1,218 @@
+// The I/O APIC routes device interrupts to the local APICs, so each IRQ
+// can be handled on a CPU of our choosing instead of always on the boot
+// CPU through the 8259A.
+// See http://www.intel.com/design/chipsets/datashts/29056601.pdf
+
+#include <inc/types.h>
+#include <inc/trap.h>
+#include <inc/memlayout.h>
+#include <inc/stdio.h>
+#include <inc/error.h>
+#include <kern/ioapic.h>
+#include <kern/picirq.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+
+physaddr_t ioapicaddr;		// Physical MMIO address of the IOAPIC
+uint8_t ioapicid;		// Its APIC ID, as the MP tables know it
+static volatile uint32_t *ioapic;
+
+// Register indices, written to IOREGSEL; the value is then in IOWIN.
+#define IOREGSEL	(0x00/4)
+#define IOWIN		(0x10/4)
+#define REG_VER		0x01	// Version; bits 16-23: max redirection entry
+#define REG_TABLE	0x10	// Redirection table, two registers per pin
+
+// Low word of a redirection table entry.  The vector is in bits 0-7;
+// delivery is fixed, to the physical APIC ID in bits 24-31 of the high
+// word.
+#define INT_ACTIVELOW	0x00002000	// Active low (else high)
+#define INT_LEVEL	0x00008000	// Level-triggered (else edge)
+#define INT_MASKED	0x00010000	// Interrupt disabled
+
+#define IOAPIC_MAXPINS	24
+
+// How each IOAPIC input is wired, from the MP tables.  ISA IRQs usually
+// come in on the input of the same number, except where the tables say
+// otherwise (commonly IRQ 0 on input 2).  PCI IRQs are identified by the
+// input they reach, which is what the BIOS puts in the PCI interrupt
+// line register.
+static uint32_t pin_flags[IOAPIC_MAXPINS];
+static uint8_t isa_pin[MAX_IRQS];
+static bool isa_pin_valid[MAX_IRQS];
+static int npins;
+
+static uint32_t
+ioapic_read(int reg)
+{
+	ioapic[IOREGSEL] = reg;
+	return ioapic[IOWIN];
+}
+
+static void
+ioapic_write(int reg, uint32_t data)
+{
+	ioapic[IOREGSEL] = reg;
+	ioapic[IOWIN] = data;
+}
+
+// Record an MP table interrupt source: bus IRQ 'irq' (on an ISA bus if
+// 'isa', else a PCI bus) reaches IOAPIC input 'pin'.  'flags' holds the
+// MP polarity (bits 0-1) and trigger mode (bits 2-3); 0 in either means
+// the bus default, which is active-high edge for ISA and active-low
+// level for PCI.
+void
+ioapic_add_source(bool isa, uint8_t irq, uint8_t pin, uint16_t flags)
+{
+	uint32_t f = isa ? 0 : INT_ACTIVELOW | INT_LEVEL;
+
+	if (pin >= IOAPIC_MAXPINS)
+		return;
+	if ((flags & 3) == 1)
+		f &= ~INT_ACTIVELOW;
+	else if ((flags & 3) == 3)
+		f |= INT_ACTIVELOW;
+	if (((flags >> 2) & 3) == 1)
+		f &= ~INT_LEVEL;
+	else if (((flags >> 2) & 3) == 3)
+		f |= INT_LEVEL;
+	pin_flags[pin] = f;
+
+	if (isa && irq < MAX_IRQS) {
+		isa_pin[irq] = pin;
+		isa_pin_valid[irq] = 1;
+	}
+}
+
+void
+ioapic_init(void)
+{
+	uint16_t asked = irq_mask_8259A;
+	int i;
+
+	if (!ioapicaddr)
+		return;
+
+	ioapic = mmio_map_region(ioapicaddr, PGSIZE);
+	npins = ((ioapic_read(REG_VER) >> 16) & 0xFF) + 1;
+	if (npins > IOAPIC_MAXPINS)
+		npins = IOAPIC_MAXPINS;
+
+	// Mark all interrupts edge-triggered, active high, disabled,
+	// and not routed to any CPUs.
+	for (i = 0; i < npins; i++) {
+		ioapic_write(REG_TABLE + 2*i, INT_MASKED | (IRQ_OFFSET + i));
+		ioapic_write(REG_TABLE + 2*i + 1, 0);
+	}
+
+	// Move the IRQs drivers have already unmasked on the 8259A over
+	// to the IOAPIC, then shut the 8259A off.
+	irq_setmask_8259A(0xFFFF);
+	for (i = 0; i < MAX_IRQS; i++)
+		if (i != IRQ_SLAVE && !(asked & (1 << i)))
+			irq_enable(i, IRQ_ANYCPU);
+}
+
+// Where each enabled IRQ should go: a CPU number, IRQ_ANYCPU or
+// IRQ_LASTCPU.  Until the APs are running it goes to the boot CPU
+// instead, since an edge-triggered interrupt sent to a CPU that is not
+// yet listening would be lost; irq_reroute then moves it.
+static bool irq_on[IOAPIC_MAXPINS];
+static int irq_cpu[IOAPIC_MAXPINS];
+static int next_cpu;
+
+// Point 'irq' at the CPU irq_cpu asks for, if it has started.
+static void
+irq_route(int irq)
+{
+	int pin = irq, cpu = irq_cpu[irq], i;
+
+	if (irq < MAX_IRQS && isa_pin_valid[irq])
+		pin = isa_pin[irq];
+	if (pin >= npins)
+		return;
+
+	if (cpu == IRQ_LASTCPU)
+		cpu = ncpu - 1;
+	if (cpu < 0 || cpu >= ncpu) {
+		// round-robin over the CPUs that are running
+		for (i = 0; i < ncpu; i++) {
+			cpu = next_cpu;
+			next_cpu = (next_cpu + 1) % ncpu;
+			if (cpus[cpu].cpu_status != CPU_UNUSED)
+				break;
+		}
+	}
+	if (cpus[cpu].cpu_status == CPU_UNUSED)
+		cpu = bootcpu - cpus;
+
+	ioapic_write(REG_TABLE + 2*pin, pin_flags[pin] | (IRQ_OFFSET + irq));
+	ioapic_write(REG_TABLE + 2*pin + 1, cpus[cpu].cpu_id << 24);
+}
+
+// Enable 'irq' and deliver it to CPU 'cpu', to the highest-numbered CPU
+// if 'cpu' is IRQ_LASTCPU, or to the next CPU in round-robin order if
+// it is IRQ_ANYCPU.  It arrives as interrupt IRQ_OFFSET + irq whichever
+// IOAPIC input it comes in on.  Without an IOAPIC, just unmask it on
+// the 8259A, which only interrupts the boot CPU.
+void
+irq_enable(int irq, int cpu)
+{
+	if (!ioapic) {
+		irq_setmask_8259A(irq_mask_8259A & ~(1 << irq));
+		return;
+	}
+	if (irq < 0 || irq >= IOAPIC_MAXPINS)
+		return;
+
+	irq_on[irq] = 1;
+	irq_cpu[irq] = cpu;
+	irq_route(irq);
+}
+
+// Send 'irq', if enabled, to 'cpu' from now on (see irq_enable).
+// Returns 0, or -E_INVAL if there is no IOAPIC or 'irq' is not enabled.
+int
+irq_set_cpu(int irq, int cpu)
+{
+	if (!ioapic || irq < 0 || irq >= IOAPIC_MAXPINS || !irq_on[irq])
+		return -E_INVAL;
+	irq_cpu[irq] = cpu;
+	irq_route(irq);
+	return 0;
+}
+
+// Route every enabled IRQ again, once the APs have started.
+void
+irq_reroute(void)
+{
+	int i;
+
+	next_cpu = 0;
+	for (i = 0; i < IOAPIC_MAXPINS; i++)
+		if (irq_on[i])
+			irq_route(i);
+}
+
+// Print where each enabled IRQ goes.
+void
+irq_print(void)
+{
+	int i, pin;
+
+	if (!ioapic) {
+		cprintf("no IOAPIC: all IRQs go to CPU 0\n");
+		return;
+	}
+	for (i = 0; i < IOAPIC_MAXPINS; i++) {
+		if (!irq_on[i])
+			continue;
+		pin = i < MAX_IRQS && isa_pin_valid[i] ? isa_pin[i] : i;
+		if (pin >= npins)
+			continue;
+		cprintf("irq %2d: pin %2d -> APIC %d (%s)\n", i, pin,
+			ioapic_read(REG_TABLE + 2*pin + 1) >> 24,
+			irq_cpu[i] == IRQ_ANYCPU ? "any" :
+			irq_cpu[i] == IRQ_LASTCPU ? "last" : "fixed");
+	}
+}
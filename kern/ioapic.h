@@ -0,0 +1,24 @@
+#ifndef JOS_KERN_IOAPIC_H
+#define JOS_KERN_IOAPIC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Pass to irq_enable to spread IRQs over the CPUs round-robin, or to
+// send one to the highest-numbered CPU.
+#define IRQ_ANYCPU	(-1)
+#define IRQ_LASTCPU	(-2)
+
+extern physaddr_t ioapicaddr;	// Initialized in mpconfig.c
+extern uint8_t ioapicid;
+
+void ioapic_add_source(bool isa, uint8_t irq, uint8_t pin, uint16_t flags);
+void ioapic_init(void);
+void irq_enable(int irq, int cpu);
+int irq_set_cpu(int irq, int cpu);
+void irq_reroute(void);
+void irq_print(void);
+
+#endif /* JOS_KERN_IOAPIC_H */
@@ -1,6 +1,7 @@
 /* See COPYRIGHT for copyright information. */
 
-/* Support for reading the NVRAM from the real-time clock. */
+/* Support for reading the NVRAM from the real-time clock,
+ * and for timing short delays with the PIT. */
 
 #include <inc/x86.h>
 
@@ -20,3 +21,32 @@ mc146818_write(unsigned reg, unsigned datum)
 	outb(IO_RTC, reg);
 	outb(IO_RTC+1, datum);
 }
+
+// Busy-wait 'ms' milliseconds (at most PIT_MAX_DELAY_MS) using channel 2
+// of the 8254 PIT.  Its input clock is the one fixed-frequency reference
+// every PC has, so time_init() uses it to calibrate the TSC and the
+// LAPIC timer.  Channel 2 only drives the speaker, so we can borrow it.
+void
+pit_delay(unsigned ms)
+{
+	uint32_t count;
+	uint8_t gate;
+
+	if (ms > PIT_MAX_DELAY_MS)
+		ms = PIT_MAX_DELAY_MS;
+	count = PIT_HZ * ms / 1000;
+
+	// Hold the gate low (and the speaker off) while loading the count,
+	// so the countdown starts exactly when we raise it.
+	gate = inb(IO_PIT_GATE) & ~0x03;
+	outb(IO_PIT_GATE, gate);
+	outb(IO_PIT_CTRL, 0xb0);	// channel 2, lo/hi byte, mode 0, binary
+	outb(IO_PIT+2, count & 0xff);
+	outb(IO_PIT+2, count >> 8);
+	outb(IO_PIT_GATE, gate | 0x01);
+
+	// In mode 0, OUT2 (bit 5) goes high when the count reaches zero.
+	while (!(inb(IO_PIT_GATE) & 0x20))
+		;
+	outb(IO_PIT_GATE, gate);
+}
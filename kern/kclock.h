@@ -23,7 +23,14 @@
 #define NVRAM_EXT16LO	(MC_NVRAM_START + 38)	/* low byte; RTC off. 0x34 */
 #define NVRAM_EXT16HI	(MC_NVRAM_START + 39)	/* high byte; RTC off. 0x35 */
 
+#define	IO_PIT		0x040		/* 8254 PIT ports */
+#define	IO_PIT_CTRL	(IO_PIT+3)	/* PIT mode/command register */
+#define	IO_PIT_GATE	0x061		/* PIT channel 2 gate and output */
+#define	PIT_HZ		1193182		/* PIT input clock, fixed on every PC */
+#define	PIT_MAX_DELAY_MS 54		/* 16-bit count at PIT_HZ */
+
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
+void pit_delay(unsigned ms);
 
 #endif	// !JOS_KERN_KCLOCK_H
@@ -142,7 +142,7 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 		// Make sure this memory is valid.
 		// Return -1 if it is not.  Hint: Call user_mem_check.
 		// LAB 3: Your code here.
-        if(!user_mem_check(curenv, usd, sizeof(struct UserStabData), 0))
+        if (user_mem_check(curenv, usd, sizeof(struct UserStabData), 0) < 0)
             return -1;
 
 		stabs = usd->stabs;
@@ -152,9 +152,9 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 
 		// Make sure the STABS and string table memory is valid.
 		// LAB 3: Your code here.
-        if (!user_mem_check(curenv, stabs, stab_end - stabs + 1, 0))
+        if (user_mem_check(curenv, stabs, stab_end - stabs + 1, 0) < 0)
             return -1;
-        if (!user_mem_check(curenv, stabstr, stabstr_end - stabstr + 1, 0))
+        if (user_mem_check(curenv, stabstr, stabstr_end - stabstr + 1, 0) < 0)
             return -1;
 	}
 
@@ -60,18 +60,20 @@ lapic_init(void)
 
 	// lapicaddr is the physical address of the LAPIC's 4K MMIO
 	// region.  Map it in to virtual memory so we can access it.
-	lapic = mmio_map_region(lapicaddr, 4096);
+	// Every CPU sees its own LAPIC at the same address, so only the
+	// BSP maps it; the APs, which start concurrently, reuse that.
+	if (!lapic)
+		lapic = mmio_map_region(lapicaddr, 4096);
 
 	// Enable local APIC; set spurious interrupt vector.
 	lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
 
-	// The timer repeatedly counts down at bus frequency
-	// from lapic[TICR] and then issues an interrupt.  
-	// If we cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
+	// The timer counts down once at bus frequency from lapic[TICR]
+	// and then issues an interrupt.  It stays stopped until the
+	// scheduler arms it with lapic_timer_oneshot().
 	lapicw(TDCR, X1);
-	lapicw(TIMER, PERIODIC | (IRQ_OFFSET + IRQ_TIMER));
-	lapicw(TICR, 10000000); 
+	lapicw(TIMER, IRQ_OFFSET + IRQ_TIMER);
+	lapicw(TICR, 0);
 
 	// Leave LINT0 of the BSP enabled so that it can get
 	// interrupts from the 8259A chip.
@@ -111,6 +113,58 @@ lapic_init(void)
 	lapicw(TPR, 0);
 }
 
+// Timer counts per millisecond.  time_init() replaces the default with
+// the rate measured against the PIT.
+static uint32_t lapic_counts_per_ms = LAPIC_COUNTS_PER_MS;
+
+// Arm this CPU's timer to interrupt once, 'ms' milliseconds from now,
+// replacing any earlier deadline.  0 stops the timer.  Deadlines too
+// far off for the 32-bit counter are cut short; the scheduler just
+// re-arms when the early interrupt arrives.
+void
+lapic_timer_oneshot(uint32_t ms)
+{
+	if (!lapic)
+		return;
+	if (ms > 0xffffffff / lapic_counts_per_ms)
+		ms = 0xffffffff / lapic_counts_per_ms;
+	lapicw(TICR, ms * lapic_counts_per_ms);
+}
+
+// Start this CPU's timer counting down from its maximum with the
+// interrupt masked, so lapic_timer_count() can time an interval.
+void
+lapic_timer_freerun(void)
+{
+	if (!lapic)
+		return;
+	lapicw(TIMER, MASKED | (IRQ_OFFSET + IRQ_TIMER));
+	lapicw(TICR, 0xffffffff);
+}
+
+// Return the current count of this CPU's timer (0 without a LAPIC).
+uint32_t
+lapic_timer_count(void)
+{
+	if (!lapic)
+		return 0;
+	return lapic[TCCR];
+}
+
+// Stop the free-running timer, unmask its interrupt, and record the
+// measured rate for every CPU's later lapic_timer_oneshot() calls.
+// A rate of 0 (calibration failed) keeps the default.
+void
+lapic_timer_calibrate(uint32_t counts_per_ms)
+{
+	if (counts_per_ms)
+		lapic_counts_per_ms = counts_per_ms;
+	if (!lapic)
+		return;
+	lapicw(TICR, 0);
+	lapicw(TIMER, IRQ_OFFSET + IRQ_TIMER);
+}
+
 int
 cpunum(void)
 {
@@ -180,3 +234,15 @@ lapic_ipi(int vector)
 	while (lapic[ICRLO] & DELIVS)
 		;
 }
+
+// Send interrupt 'vector' to the CPU with local APIC ID 'apicid' only.
+void
+lapic_ipi_cpu(uint8_t apicid, int vector)
+{
+	if (!lapic)
+		return;
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
@@ -11,6 +11,12 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/cpu.h>
+#include <kern/time.h>
+#include <kern/syscall.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
+#include <kern/ioapic.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -26,6 +32,12 @@ static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
     { "backtrace", "Display the backtrace of stack", mon_backtrace },
+	{ "intrlat", "Display the longest time each CPU ran with interrupts off", mon_intrlat },
+	{ "syscalls", "Display system call counts and latencies; 'syscalls reset' clears them", mon_syscalls },
+	{ "prof", "Sampling profiler: 'prof start [ms]', 'prof stop', 'prof dump'", mon_prof },
+	{ "trace", "Event tracing: 'trace mask [hex]', 'trace dump', 'trace clear'", mon_trace },
+	{ "irq", "Show IRQ routing; 'irq N CPU' sends IRQ N to CPU ('any' spreads)", mon_irq },
+	{ "continue", "Leave the monitor and resume the trapped environment", mon_continue },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -85,6 +97,107 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 }
 
 
+int
+mon_intrlat(int argc, char **argv, struct Trapframe *tf)
+{
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		cprintf("CPU %d: %llu us\n", i,
+			cpus[i].cpu_intr_off_max * 1000000 / clockinfo.ci_tsc_hz);
+	return 0;
+}
+
+int
+mon_syscalls(int argc, char **argv, struct Trapframe *tf)
+{
+	static const char *type_names[ENV_NTYPES] = { "user", "fs", "ns" };
+	static struct SyscallStat stats[NSYSCALLS];
+	uint64_t n;
+	int i, t, j;
+
+	syscall_stats_get(stats, argc > 1 && strcmp(argv[1], "reset") == 0);
+	cprintf("%-22s %-4s %8s %8s  log2(cycles):calls\n",
+		"syscall", "env", "calls", "avg cyc");
+	for (i = 0; i < NSYSCALLS; i++)
+		for (t = 0; t < ENV_NTYPES; t++) {
+			struct SyscallStat *ss = &stats[i];
+			if (!ss->ss_count[t])
+				continue;
+			for (n = 0, j = 0; j < SYSSTAT_NHIST; j++)
+				n += ss->ss_hist[t][j];
+			cprintf("%-22s %-4s %8llu %8llu ", syscall_name(i),
+				type_names[t], ss->ss_count[t],
+				n ? ss->ss_cycles[t] / n : 0);
+			for (j = 0; j < SYSSTAT_NHIST; j++)
+				if (ss->ss_hist[t][j])
+					cprintf(" %d:%u", j, ss->ss_hist[t][j]);
+			cprintf("\n");
+		}
+	return 0;
+}
+
+int
+mon_prof(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+		prof_start(argc >= 3 ? strtol(argv[2], NULL, 0) : 1);
+		cprintf("profiling every %u ms\n", prof_period);
+	} else if (argc >= 2 && strcmp(argv[1], "stop") == 0)
+		prof_stop();
+	else if (argc >= 2 && strcmp(argv[1], "dump") == 0)
+		prof_dump();
+	else
+		cprintf("usage: prof start [ms] | stop | dump\n");
+	return 0;
+}
+
+int
+mon_trace(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc >= 2 && strcmp(argv[1], "mask") == 0) {
+		if (argc >= 3)
+			trace_mask = strtol(argv[2], NULL, 16) & TRACE_ALL;
+		cprintf("trace mask %x\n", trace_mask);
+	} else if (argc >= 2 && strcmp(argv[1], "dump") == 0)
+		trace_dump();
+	else if (argc >= 2 && strcmp(argv[1], "clear") == 0)
+		trace_clear();
+	else
+		cprintf("usage: trace mask [hex] | dump | clear\n");
+	return 0;
+}
+
+int
+mon_irq(int argc, char **argv, struct Trapframe *tf)
+{
+	int cpu;
+
+	if (argc == 3) {
+		cpu = strcmp(argv[2], "any") == 0 ? IRQ_ANYCPU
+			: strtol(argv[2], NULL, 0);
+		if (cpu != IRQ_ANYCPU && (cpu < 0 || cpu >= ncpu))
+			cprintf("no CPU %s\n", argv[2]);
+		else if (irq_set_cpu(strtol(argv[1], NULL, 0), cpu) < 0)
+			cprintf("irq %s is not routed by the IOAPIC\n", argv[1]);
+	} else if (argc != 1) {
+		cprintf("usage: irq [N CPU|any]\n");
+		return 0;
+	}
+	irq_print();
+	return 0;
+}
+
+int
+mon_continue(int argc, char **argv, struct Trapframe *tf)
+{
+	if (!tf) {
+		cprintf("No environment to continue.\n");
+		return 0;
+	}
+	return -1;
+}
+
 
 /***** Kernel monitor command interpreter *****/
 
@@ -134,6 +247,10 @@ void
 monitor(struct Trapframe *tf)
 {
 	char *buf;
+	bool sync;
+
+	// Interrupts are off in here, so print synchronously.
+	sync = cons_set_sync(1);
 
 	cprintf("Welcome to the JOS kernel monitor!\n");
 	cprintf("Type 'help' for a list of commands.\n");
@@ -147,4 +264,5 @@ monitor(struct Trapframe *tf)
 			if (runcmd(buf, tf) < 0)
 				break;
 	}
+	cons_set_sync(sync);
 }
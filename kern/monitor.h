@@ -15,5 +15,11 @@ void monitor(struct Trapframe *tf);
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_intrlat(int argc, char **argv, struct Trapframe *tf);
+int mon_syscalls(int argc, char **argv, struct Trapframe *tf);
+int mon_prof(int argc, char **argv, struct Trapframe *tf);
+int mon_trace(int argc, char **argv, struct Trapframe *tf);
+int mon_irq(int argc, char **argv, struct Trapframe *tf);
+int mon_continue(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -9,6 +9,7 @@
 #include <inc/env.h>
 #include <kern/cpu.h>
 #include <kern/pmap.h>
+#include <kern/ioapic.h>
 
 struct CpuInfo cpus[NCPU];
 struct CpuInfo *bootcpu;
@@ -62,6 +63,36 @@ struct mpproc {         // processor table entry [MP 4.3.1]
 // mpproc flags
 #define MPPROC_BOOT 0x02                // This mpproc is the bootstrap processor
 
+struct mpbus {          // bus table entry [MP 4.3.2]
+	uint8_t type;                   // entry type (1)
+	uint8_t busid;                  // bus id
+	uint8_t bustype[6];             // "ISA   ", "PCI   ", ...
+} __attribute__((__packed__));
+
+struct mpioapic {       // I/O APIC table entry [MP 4.3.3]
+	uint8_t type;                   // entry type (2)
+	uint8_t apicno;                 // I/O APIC id
+	uint8_t version;                // I/O APIC version
+	uint8_t flags;                  // I/O APIC flags
+	physaddr_t addr;                // I/O APIC address
+} __attribute__((__packed__));
+
+// mpioapic flags
+#define MPIOAPIC_EN 0x01                // This I/O APIC is usable
+
+struct mpioint {        // I/O interrupt assignment entry [MP 4.3.4]
+	uint8_t type;                   // entry type (3)
+	uint8_t irqtype;                // interrupt type
+	uint16_t irqflag;               // polarity and trigger mode
+	uint8_t srcbus;                 // source bus id
+	uint8_t srcbusirq;              // source bus irq
+	uint8_t dstapic;                // destination I/O APIC id
+	uint8_t dstirq;                 // destination I/O APIC input
+} __attribute__((__packed__));
+
+// mpioint irqtypes
+#define MPINT_INT   0x00                // Vectored interrupt
+
 // Table entry types
 #define MPPROC    0x00  // One per processor
 #define MPBUS     0x01  // One per bus
@@ -168,6 +199,10 @@ mp_init(void)
 	struct mp *mp;
 	struct mpconf *conf;
 	struct mpproc *proc;
+	struct mpbus *bus;
+	struct mpioapic *ioa;
+	struct mpioint *ioi;
+	uint32_t pcibuses = 0;
 	uint8_t *p;
 	unsigned int i;
 
@@ -193,8 +228,31 @@ mp_init(void)
 			p += sizeof(struct mpproc);
 			continue;
 		case MPBUS:
+			bus = (struct mpbus *)p;
+			if (bus->busid < 32 && memcmp(bus->bustype, "PCI", 3) == 0)
+				pcibuses |= 1 << bus->busid;
+			p += 8;
+			continue;
 		case MPIOAPIC:
+			// We only use the first I/O APIC.
+			ioa = (struct mpioapic *)p;
+			if ((ioa->flags & MPIOAPIC_EN) && !ioapicaddr) {
+				ioapicaddr = ioa->addr;
+				ioapicid = ioa->apicno;
+			}
+			p += 8;
+			continue;
 		case MPIOINTR:
+			// The bus entries come first [MP 4.2].
+			ioi = (struct mpioint *)p;
+			if (ioi->irqtype == MPINT_INT && ioapicaddr &&
+			    (ioi->dstapic == ioapicid || ioi->dstapic == 0xFF))
+				ioapic_add_source(ioi->srcbus >= 32 ||
+						  !(pcibuses & (1 << ioi->srcbus)),
+						  ioi->srcbusirq, ioi->dstirq,
+						  ioi->irqflag);
+			p += 8;
+			continue;
 		case MPLINTR:
 			p += 8;
 			continue;
@@ -210,6 +268,7 @@ mp_init(void)
 		// Didn't like what we found; fall back to no MP.
 		ncpu = 1;
 		lapicaddr = 0;
+		ioapicaddr = 0;
 		cprintf("SMP: configuration not found, SMP disabled\n");
 		return;
 	}
@@ -10,6 +10,7 @@
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/trace.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -176,8 +177,10 @@ mem_init(void)
 	page_init();
 
 	check_page_free_list(1);
+#ifdef PMAP_CHECK
 	check_page_alloc();
 	check_page();
+#endif
 
 	//////////////////////////////////////////////////////////////////////
 	// Now we set up virtual memory
@@ -231,7 +234,9 @@ mem_init(void)
 	mem_init_mp();
 
 	// Check that the initial page directory has been set up correctly.
+#ifdef PMAP_CHECK
 	check_kern_pgdir();
+#endif
 
 	// Switch from the minimal entry page directory to the full kern_pgdir
 	// page table we just created.	Our instruction pointer should be
@@ -252,7 +257,9 @@ mem_init(void)
 	lcr0(cr0);
 
 	// Some more checks, only possible after kern_pgdir is installed.
+#ifdef PMAP_CHECK
 	check_page_installed_pgdir();
+#endif
 }
 
 // Modify mappings in kern_pgdir to support SMP
@@ -362,6 +369,7 @@ page_alloc(int alloc_flags)
         memset((uintptr_t *)page2kva(new_page), 0, PGSIZE);
 
     assert(new_page->pp_ref == 0);
+    TRACE(TRACE_PAGE_ALLOC, page2pa(new_page), alloc_flags, 0);
     return new_page;
 }
 
@@ -0,0 +1,203 @@
+// Sampling profiler.
+//
+// While it runs, every CPU takes a LAPIC timer interrupt at least every
+// prof_period milliseconds (see sched_arm), and each timer interrupt
+// records the interrupted call stack in that CPU's ring of samples,
+// overwriting the oldest once the ring is full.  prof_dump prints the
+// samples as folded stacks, one line per distinct stack:
+//
+//	env_00001001;umain;fork;duppage;sys_page_map;syscall 12
+//
+// which flamegraph.pl turns into a flame graph.  Kernel addresses are
+// named from the kernel's stabs and user addresses from the stabs the
+// environment has at USTABDATA.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+
+#include <kern/prof.h>
+#include <kern/cpu.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/kdebug.h>
+
+#define PROF_NSAMPLES	1024		// Samples per CPU
+#define PROF_DEPTH	8		// Frames per sample
+
+struct ProfSample {
+	envid_t ps_env;			// Env running on the CPU, or 0
+	uint8_t ps_depth;		// Entries used in ps_pc
+	uint8_t ps_done;		// Already printed by prof_dump
+	uintptr_t ps_pc[PROF_DEPTH];	// Innermost frame first
+};
+
+static struct ProfRing {
+	uint32_t pr_head;		// Samples ever taken
+	struct ProfSample pr_samples[PROF_NSAMPLES];
+} prof_rings[NCPU];
+
+unsigned prof_period;
+
+// Clear the rings and start sampling every 'period' milliseconds.
+void
+prof_start(unsigned period)
+{
+	memset(prof_rings, 0, sizeof(prof_rings));
+	prof_period = period ? period : 1;
+}
+
+void
+prof_stop(void)
+{
+	prof_period = 0;
+}
+
+// Append the return addresses of the frames starting at 'ebp' to
+// pc[n..PROF_DEPTH-1], while the frames lie within [lo, hi).  User
+// frames are only followed where the current env maps them.
+// Returns the new number of entries in pc.
+static int
+prof_walk(uintptr_t *pc, int n, uint32_t ebp, uint32_t lo, uint32_t hi,
+	  bool user)
+{
+	uint32_t *frame;
+
+	while (n < PROF_DEPTH && ebp >= lo && ebp + 8 <= hi && ebp % 4 == 0) {
+		frame = (uint32_t *) ebp;
+		if (user && user_mem_check(curenv, frame, 8, PTE_U) < 0)
+			break;
+		pc[n++] = frame[1];
+		// callers' frames are further up the stack
+		if (frame[0] <= ebp)
+			break;
+		ebp = frame[0];
+	}
+	return n;
+}
+
+// Record the call stack interrupted by the timer interrupt 'tf'.  An
+// interrupt in the kernel records the kernel frames, then the frames
+// of the env the kernel was working for, if its memory is mapped.
+void
+prof_sample(struct Trapframe *tf)
+{
+	struct ProfRing *pr;
+	struct ProfSample *ps;
+	struct Trapframe *utf = NULL;
+	uint32_t kstacktop = KSTACKTOP - cpunum() * (KSTKSIZE + KSTKGAP);
+	int n = 0;
+
+	if (!prof_period)
+		return;
+
+	pr = &prof_rings[cpunum()];
+	ps = &pr->pr_samples[pr->pr_head++ % PROF_NSAMPLES];
+	ps->ps_env = curenv ? curenv->env_id : 0;
+	ps->ps_done = 0;
+
+	if ((tf->tf_cs & 3) == 3)
+		utf = tf;
+	else {
+		ps->ps_pc[n++] = tf->tf_eip;
+		n = prof_walk(ps->ps_pc, n, tf->tf_regs.reg_ebp,
+			      kstacktop - KSTKSIZE, kstacktop, 0);
+		// env_free and load_icode may run on another page directory
+		if (curenv && rcr3() == PADDR(curenv->env_pgdir))
+			utf = &curenv->env_tf;
+	}
+	if (utf && n < PROF_DEPTH) {
+		ps->ps_pc[n++] = utf->tf_eip;
+		n = prof_walk(ps->ps_pc, n, utf->tf_regs.reg_ebp,
+			      UTEXT, UXSTACKTOP, 1);
+	}
+	ps->ps_depth = n;
+}
+
+// Make the env with id 'envid' current, so that debuginfo_eip reads its
+// stabs.  Returns false if that env is gone.
+static bool
+prof_use_env(envid_t envid)
+{
+	struct Env *e = &envs[ENVX(envid)];
+
+	if (!envid || e->env_id != envid || e->env_status == ENV_FREE)
+		return 0;
+	if (curenv != e) {
+		curenv = e;
+		lcr3(PADDR(e->env_pgdir));
+	}
+	return 1;
+}
+
+// Look up the function containing 'pc', an address in the env with id
+// 'envid' or in the kernel.  Returns 0 on success, < 0 if not found.
+static int
+prof_lookup(uintptr_t pc, envid_t envid, struct Eipdebuginfo *info)
+{
+	if (pc < ULIM && !prof_use_env(envid))
+		return -1;
+	return debuginfo_eip(pc, info);
+}
+
+// Print every CPU's samples as folded stacks, then clear them.
+void
+prof_dump(void)
+{
+	struct Env *saved = curenv;
+	struct Eipdebuginfo info;
+	struct ProfSample *ps, *qs;
+	uint32_t nsamples[NCPU];
+	int c, i, d, k, l, count;
+
+	// Replace each address by the start of its function, so that
+	// samples in the same functions compare equal.
+	for (c = 0; c < ncpu; c++) {
+		nsamples[c] = MIN(prof_rings[c].pr_head, PROF_NSAMPLES);
+		cprintf("# CPU %d: %u samples, %u overwritten\n", c,
+			prof_rings[c].pr_head, prof_rings[c].pr_head - nsamples[c]);
+		for (i = 0; i < nsamples[c]; i++) {
+			ps = &prof_rings[c].pr_samples[i];
+			for (d = 0; d < ps->ps_depth; d++)
+				if (prof_lookup(ps->ps_pc[d], ps->ps_env, &info) == 0)
+					ps->ps_pc[d] = info.eip_fn_addr;
+		}
+	}
+
+	for (c = 0; c < ncpu; c++)
+		for (i = 0; i < nsamples[c]; i++) {
+			ps = &prof_rings[c].pr_samples[i];
+			if (ps->ps_done)
+				continue;
+
+			// Count this stack on every CPU.
+			count = 0;
+			for (k = c; k < ncpu; k++)
+				for (l = (k == c ? i : 0); l < nsamples[k]; l++) {
+					qs = &prof_rings[k].pr_samples[l];
+					if (!qs->ps_done && qs->ps_env == ps->ps_env
+					    && qs->ps_depth == ps->ps_depth
+					    && memcmp(qs->ps_pc, ps->ps_pc,
+						      ps->ps_depth * sizeof(uintptr_t)) == 0) {
+						qs->ps_done = 1;
+						count++;
+					}
+				}
+
+			if (ps->ps_env)
+				cprintf("env_%08x", ps->ps_env);
+			else
+				cprintf("kernel");
+			for (d = ps->ps_depth - 1; d >= 0; d--)
+				if (prof_lookup(ps->ps_pc[d], ps->ps_env, &info) == 0)
+					cprintf(";%.*s", info.eip_fn_namelen,
+						info.eip_fn_name);
+				else
+					cprintf(";0x%08x", ps->ps_pc[d]);
+			cprintf(" %d\n", count);
+		}
+
+	curenv = saved;
+	lcr3(saved ? PADDR(saved->env_pgdir) : PADDR(kern_pgdir));
+	memset(prof_rings, 0, sizeof(prof_rings));
+}
@@ -0,0 +1,17 @@
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+
+// Milliseconds between samples while the profiler runs, or 0.
+extern unsigned prof_period;
+
+void prof_start(unsigned period);
+void prof_stop(void);
+void prof_sample(struct Trapframe *tf);
+void prof_dump(void);
+
+#endif /* JOS_KERN_PROF_H */
@@ -1,12 +1,402 @@
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/error.h>
 #include <kern/spinlock.h>
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
+#include <kern/cpu.h>
+#include <kern/timer.h>
+#include <kern/work.h>
+#include <kern/trap.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
 
 void sched_halt(void);
 
+// Multi-level feedback queue.  An env at level L may run for
+// SCHED_QUANTUM(L) ticks of SCHED_TICK_MS before it is demoted one
+// level; an env that blocks before using up its quantum moves up one
+// level.  Every SCHED_BOOST_MS all envs go back to level 0, so demoted
+// envs cannot starve.  Envs pinned with sys_env_set_priority never
+// change level.
+#define SCHED_TICK_MS		10
+#define SCHED_QUANTUM(level)	(1U << (level))
+#define SCHED_BOOST_MS		1000
+
+// The LAPIC timer runs in one-shot mode, armed only for the end of the
+// running env's time slice, if some other env is waiting for the CPU
+// (see sched_run), and for the next kernel timer (see kern/timer.c).  A
+// halted CPU sleeps until then, another interrupt, or a reschedule IPI
+// from sched_wakeup.
+
+// Stride scheduling.  An env's pass advances by its stride,
+// STRIDE1 / env_tickets, per 1024 TSC cycles it runs, and the runnable
+// env with the lowest pass goes next, so envs get CPU time in proportion
+// to their tickets.  Cycles short of 1024 carry over to the next charge
+// in env_pass_cycles, so an env that traps often still pays for all of
+// them.  An env that has been blocked cannot bank the time: its pass is
+// brought up to global_pass, the pass of the last env picked.
+#define STRIDE1			(1 << 20)
+#define STRIDE_CYCLES_SHIFT	10
+
+static int sched_policy = SCHED_POLICY_MLFQ;
+static uint64_t global_pass;
+
+// Switch to 'policy'.  Returns the previous policy, or -E_INVAL.
+int
+sched_set_policy(int policy)
+{
+    int old = sched_policy;
+    if (policy != SCHED_POLICY_MLFQ && policy != SCHED_POLICY_STRIDE)
+        return -E_INVAL;
+    sched_policy = policy;
+    return old;
+}
+
+// Set up the scheduling state of the new env 'e'.
+void
+sched_init_env(struct Env *e)
+{
+    e->env_tickets = ENV_DEFAULT_TICKETS;
+    e->env_pass = global_pass;
+    e->env_pass_cycles = 0;
+}
+
+// Scheduling-context donation.  A client blocked in ipc_call lends
+// its scheduling context to the callee until the reply: the callee
+// competes at the best of its own and its donors' levels (under the
+// stride policy, with the lowest of their passes), and while it runs
+// on a donor's behalf the donor pays for it, using up the donor's
+// quantum and advancing the donor's pass.  So calling an accomplice
+// gets a client no more CPU than running itself would.
+
+// The level an env competes at by itself.  Under the stride policy all
+// envs share one level and are ordered by pass.
+static int
+sched_own_level(struct Env *e)
+{
+    return sched_policy == SCHED_POLICY_STRIDE ? 1 : e->env_priority;
+}
+
+// The env whose scheduling context 'e' runs on: the best of its
+// donors, if that is better than 'e' itself, else 'e'.
+static struct Env *
+sched_payer(struct Env *e)
+{
+    struct Env *d, *best = e;
+
+    for (d = e->env_ipc_donors; d; d = d->env_ipc_donor_next)
+        if (sched_own_level(d) < sched_own_level(best) ||
+                (sched_policy == SCHED_POLICY_STRIDE &&
+                 d->env_pass < best->env_pass))
+            best = d;
+    return best;
+}
+
+// The level 'e' competes at, donations included.
+static int
+sched_level(struct Env *e)
+{
+    return sched_own_level(sched_payer(e));
+}
+
+// The stride pass 'e' competes with, donations included.
+static uint64_t
+sched_pass(struct Env *e)
+{
+    return sched_payer(e)->env_pass;
+}
+
+// Charge 'e' for the CPU time since env_run last dispatched it.  The
+// stride pass of whoever it runs for advances.
+void
+sched_charge(struct Env *e)
+{
+    uint64_t now = read_tsc();
+    uint64_t cycles = now - e->env_run_start;
+    struct Env *p = sched_payer(e);
+
+    e->env_runtime += cycles;
+    e->env_run_start = now;
+    cycles += p->env_pass_cycles;
+    p->env_pass += (cycles >> STRIDE_CYCLES_SHIFT) * (STRIDE1 / p->env_tickets);
+    p->env_pass_cycles = cycles & ((1 << STRIDE_CYCLES_SHIFT) - 1);
+}
+
+// Lend 'donor''s scheduling context to 'callee' until it replies.  A
+// donor that has been blocked cannot bank the time for its callee, as
+// in sched_next.
+void
+sched_donate(struct Env *donor, struct Env *callee)
+{
+    if (donor->env_pass < global_pass)
+        donor->env_pass = global_pass;
+    donor->env_ipc_donee = callee;
+    donor->env_ipc_donor_next = callee->env_ipc_donors;
+    callee->env_ipc_donors = donor;
+}
+
+// End 'donor''s donation to the callee of its ipc_call.
+void
+sched_undonate(struct Env *donor)
+{
+    struct Env **pp;
+
+    if (!donor->env_ipc_donee)
+        return;
+    for (pp = &donor->env_ipc_donee->env_ipc_donors; *pp;
+            pp = &(*pp)->env_ipc_donor_next)
+        if (*pp == donor) {
+            *pp = donor->env_ipc_donor_next;
+            break;
+        }
+    donor->env_ipc_donee = NULL;
+}
+
+// 'e' is being freed: end its donation and the donations to it.
+void
+sched_donation_free(struct Env *e)
+{
+    struct Env *d;
+
+    sched_undonate(e);
+    for (d = e->env_ipc_donors; d; d = d->env_ipc_donor_next)
+        d->env_ipc_donee = NULL;
+    e->env_ipc_donors = NULL;
+}
+
+// Whether 'e' may run on this CPU.
+bool
+sched_allowed(struct Env *e)
+{
+    return (e->env_affinity >> thiscpu->cpu_id) & 1;
+}
+
+// Whether 'a' is a better choice than 'b' for this CPU: it is at a
+// better level, or at the same level and last ran here, so its cache
+// and TLB state may still be warm.
+static bool
+sched_better(struct Env *a, struct Env *b)
+{
+    if (sched_level(a) != sched_level(b))
+        return sched_level(a) < sched_level(b);
+    if (sched_policy == SCHED_POLICY_STRIDE && sched_pass(a) != sched_pass(b))
+        return sched_pass(a) < sched_pass(b);
+    return a->env_cpunum == thiscpu->cpu_id &&
+        b->env_cpunum != thiscpu->cpu_id;
+}
+
+// Find the best ENV_RUNNABLE environment allowed on this CPU in 'envs',
+// searching in circular fashion starting just after 'last', so equally
+// good envs take turns.  The number of such runnable envs is stored in
+// *nrunnable.
+static struct Env *
+sched_next(struct Env *last, int *nrunnable)
+{
+    unsigned start = last ? ENVX(last->env_id) + 1 : 0;
+    struct Env *best = NULL;
+    unsigned i;
+
+    *nrunnable = 0;
+    for (i = 0; i < NENV; i++) {
+        struct Env *e = &envs[(start + i) % NENV];
+        if (e->env_status != ENV_RUNNABLE || !sched_allowed(e))
+            continue;
+        ++*nrunnable;
+        if (e->env_pass < global_pass)
+            e->env_pass = global_pass;
+        if (!best || sched_better(e, best))
+            best = e;
+    }
+    if (best && sched_policy == SCHED_POLICY_STRIDE)
+        global_pass = sched_pass(best);
+    return best;
+}
+
+// Move every env that is not pinned back to the top level, once every
+// SCHED_BOOST_MS.
+static void
+sched_boost(void)
+{
+    static unsigned last_boost;
+    int i;
+
+    if (time_msec() - last_boost < SCHED_BOOST_MS)
+        return;
+    last_boost = time_msec();
+
+    for (i = 0; i < NENV; i++) {
+        if (envs[i].env_status != ENV_FREE && !envs[i].env_prio_pinned) {
+            envs[i].env_priority = 0;
+            envs[i].env_ticks = 0;
+        }
+    }
+}
+
+// Program this CPU's one-shot timer for its next deadline: the end of
+// the current time slice or the next kernel timer, whichever is first,
+// and no later than the next sample while the profiler runs.
+static void
+sched_arm(void)
+{
+    uint32_t deadline = thiscpu->cpu_slice_end;
+    uint32_t when;
+    int32_t left;
+
+    if (timer_next(&when) && (!deadline || (int32_t)(when - deadline) < 0))
+        deadline = when ? when : 1;
+    // the profiler samples on timer interrupts
+    if (prof_period) {
+        when = time_msec() + prof_period;
+        if (!deadline || (int32_t)(when - deadline) < 0)
+            deadline = when ? when : 1;
+    }
+    if (!deadline) {
+        lapic_timer_oneshot(0);
+        return;
+    }
+    left = deadline - time_msec();
+    lapic_timer_oneshot(left > 0 ? left : 1);
+}
+
+// Start a time slice for the env 'e' on this CPU: the rest of the
+// quantum of whoever it runs for, or a single tick under the stride
+// policy.
+static void
+sched_start_slice(struct Env *e)
+{
+    uint32_t ticks = 1;
+
+    e = sched_payer(e);
+    if (sched_policy == SCHED_POLICY_MLFQ &&
+            e->env_ticks < SCHED_QUANTUM(e->env_priority))
+        ticks = SCHED_QUANTUM(e->env_priority) - e->env_ticks;
+    thiscpu->cpu_slice_end = thiscpu->cpu_slice_start + ticks * SCHED_TICK_MS;
+    if (!thiscpu->cpu_slice_end)
+        thiscpu->cpu_slice_end = 1;
+}
+
+// Charge whoever 'e' runs for with the part of its time slice 'e' used
+// on this CPU.
+static void
+sched_end_slice(struct Env *e)
+{
+    if (thiscpu->cpu_slice_end)
+        sched_payer(e)->env_ticks += (time_msec() - thiscpu->cpu_slice_start) / SCHED_TICK_MS;
+    thiscpu->cpu_slice_end = 0;
+}
+
+// Run 'e' on this CPU.  If 'contended', other envs are waiting for this
+// CPU, so arm the timer to preempt 'e' at the end of its time slice;
+// otherwise let it run without timer interrupts.
+static void
+sched_run(struct Env *e, bool contended)
+{
+    thiscpu->cpu_slice_start = time_msec();
+    thiscpu->cpu_slice_end = 0;
+    if (contended)
+        sched_start_slice(e);
+    sched_arm();
+    env_run(e); // no return
+}
+
+// Called on this CPU's timer interrupt.  Fire any kernel timers that
+// are due, and demote the running env if it has used up its time
+// slice.  Returns true if this CPU should reschedule: it is idle, its
+// env's slice is over, or a better env is runnable.
+bool
+sched_tick(void)
+{
+    int i;
+
+    timer_run();
+    sched_boost();
+
+    if (!curenv || curenv->env_status != ENV_RUNNING || !sched_allowed(curenv))
+        return 1;
+
+    // allow for the LAPIC and the TSC disagreeing by a millisecond
+    if (thiscpu->cpu_slice_end &&
+            (int32_t)(time_msec() + 1 - thiscpu->cpu_slice_end) >= 0) {
+        struct Env *p = sched_payer(curenv);
+        if (sched_policy == SCHED_POLICY_MLFQ && !p->env_prio_pinned &&
+                p->env_priority < NPRIO - 1)
+            p->env_priority++;
+        p->env_ticks = 0;
+        thiscpu->cpu_slice_end = 0;
+        return 1;
+    }
+
+    for (i = 0; i < NENV; i++)
+        if (envs[i].env_status == ENV_RUNNABLE && sched_allowed(&envs[i]) &&
+                sched_level(&envs[i]) < sched_level(curenv))
+            return 1;
+
+    // an early interrupt; wait for the real deadline
+    sched_arm();
+    return 0;
+}
+
+// Note that 'e' blocked before using up its quantum: move it up a level.
+// An env blocked in ipc_call is not giving up the CPU but lending it
+// to its callee, which goes on using its quantum.
+void
+sched_blocked(struct Env *e)
+{
+    if (e->env_ipc_donee)
+        return;
+    if (!e->env_prio_pinned && e->env_priority > 0)
+        e->env_priority--;
+    e->env_ticks = 0;
+}
+
+// Note that 'e' just became runnable, which ends any sleep or timeout
+// it was waiting on.  Wake up a halted CPU that may run it with a
+// reschedule IPI, preferring the one it last ran on.  If there is none,
+// make sure some CPU allowed to run 'e' will reschedule soon: start a
+// time slice here if this CPU had its env to itself, or interrupt a
+// CPU that may run 'e', preferring the one it last ran on.
+void
+sched_wakeup(struct Env *e)
+{
+    struct CpuInfo *c, *target = NULL;
+
+    timer_cancel(&e->env_timer);
+
+    for (c = cpus; c < cpus + ncpu; c++) {
+        if (c == thiscpu || c->cpu_status != CPU_HALTED ||
+                !((e->env_affinity >> c->cpu_id) & 1))
+            continue;
+        if (!target || c->cpu_id == e->env_cpunum)
+            target = c;
+    }
+
+    if (!target && sched_allowed(e)) {
+        if (curenv && curenv != e && curenv->env_status == ENV_RUNNING &&
+                !thiscpu->cpu_slice_end) {
+            sched_start_slice(curenv);
+            sched_arm();
+        }
+        return;
+    }
+
+    // Otherwise pick a running CPU 'e' may use, the one it last ran
+    // on if allowed.
+    if (!target && e->env_cpunum >= 0 && e->env_cpunum < ncpu &&
+            ((e->env_affinity >> e->env_cpunum) & 1))
+        target = &cpus[e->env_cpunum];
+    for (c = cpus; !target && c < cpus + ncpu; c++)
+        if (c != thiscpu && c->cpu_status != CPU_UNUSED &&
+                ((e->env_affinity >> c->cpu_id) & 1))
+            target = c;
+    if (target && target != thiscpu && !target->cpu_resched) {
+        target->cpu_resched = 1;
+        lapic_ipi_cpu(target->cpu_id, IRQ_OFFSET + IRQ_RESCHED);
+    }
+}
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
@@ -27,42 +417,56 @@ sched_yield(void)
 	// another CPU (env_status == ENV_RUNNING). If there are
 	// no runnable environments, simply drop through to the code
 	// below to halt the cpu.
+	//
+	// On top of that, only the envs at the best MLFQ level (see
+	// sched_level) take turns, only on CPUs their affinity allows,
+	// and an env that last ran on this CPU goes first.
 
 	// LAB 4: Your code here.
     struct Env *last_env = thiscpu->cpu_env;
-    unsigned last_env_index = NENV;
-    struct Env *first_runnable_env = NULL;
-    unsigned i = 0;
+    TRACE(TRACE_SCHED_YIELD, last_env ? last_env->env_id : 0, 0, 0);
+    bool last_running = last_env && last_env->env_status == ENV_RUNNING &&
+        last_env->env_cpunum == thiscpu->cpu_id;
+    int nrunnable;
 
-    for (idle = &envs[i++]; i < NENV && idle != NULL; idle = &envs[i++]) {
-        if (idle == last_env) {
-            last_env_index = i - 1;
-            continue;
-        }
+    // Deferred interrupt work may make envs runnable.  This is the
+    // reschedule an interrupt may have asked for.
+    work_run();
+    thiscpu->cpu_preempt = 0;
+    sched_boost();
 
-        if (idle && idle->env_status == ENV_RUNNABLE) {
-            if (first_runnable_env == NULL)
-                first_runnable_env = idle;
-            if (i > last_env_index)
-                env_run(idle); // no return
-        }
-    }
+    if (last_env)
+        sched_end_slice(last_env);
+    if (last_env && last_env->env_status == ENV_NOT_RUNNABLE)
+        sched_blocked(last_env);
 
-    if (first_runnable_env) {
-        assert(first_runnable_env != last_env);
-        env_run(first_runnable_env); // no return
+    // An env whose affinity no longer allows this CPU must move;
+    // make it runnable so an allowed CPU can pick it up.
+    if (last_running && !sched_allowed(last_env)) {
+        last_env->env_status = ENV_RUNNABLE;
+        last_running = 0;
+        sched_wakeup(last_env);
     }
 
-    if (last_env && last_env->env_status == ENV_RUNNING && last_env->env_cpunum == thiscpu->cpu_id) {
-        env_run(last_env); // no return
-    }
+    idle = sched_next(last_env, &nrunnable);
+
+    // Only give up the CPU to an env at the same or a better level
+    // (under the stride policy, with no higher a pass).
+    if (last_running && (!idle || sched_level(idle) > sched_level(last_env) ||
+                (sched_policy == SCHED_POLICY_STRIDE &&
+                 sched_level(idle) == sched_level(last_env) &&
+                 sched_pass(last_env) < sched_pass(idle))))
+        sched_run(last_env, nrunnable > 0); // no return
+
+    if (idle)
+        sched_run(idle, nrunnable > 1 || last_running); // no return
 
 	// sched_halt never returns
     sched_halt();
 }
 
 // Halt this CPU when there is nothing to do. Wait until the
-// timer interrupt wakes it up. This function never returns.
+// timer or another interrupt wakes it up. This function never returns.
 //
 void
 sched_halt(void)
@@ -86,6 +490,8 @@ sched_halt(void)
 	// Mark that no environment is running on this CPU
 	curenv = NULL;
 	lcr3(PADDR(kern_pgdir));
+	thiscpu->cpu_slice_end = 0;
+	sched_arm();
 
 	// Mark that this CPU is in the HALT state, so that when
 	// timer interupts come in, we know we should re-acquire the
@@ -94,6 +500,7 @@ sched_halt(void)
 
 	// Release the big kernel lock as if we were "leaving" the kernel
 	unlock_kernel();
+	intr_off_end();
 
 	// Reset stack pointer, enable interrupts and then halt.
 	asm volatile (
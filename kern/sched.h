@@ -6,7 +6,19 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+struct Env;
+
 // This function does not return.
 void sched_yield(void) __attribute__((noreturn));
+bool sched_tick(void);
+void sched_blocked(struct Env *e);
+void sched_wakeup(struct Env *e);
+bool sched_allowed(struct Env *e);
+void sched_donate(struct Env *donor, struct Env *callee);
+void sched_undonate(struct Env *donor);
+void sched_donation_free(struct Env *e);
+void sched_charge(struct Env *e);
+void sched_init_env(struct Env *e);
+int sched_set_policy(int policy);
 
 #endif	// !JOS_KERN_SCHED_H
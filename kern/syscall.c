@@ -7,12 +7,16 @@
 
 #include <kern/env.h>
 #include <kern/e1000.h>
+#include <kern/ide.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
 #include <kern/time.h>
+#include <kern/timer.h>
+#include <kern/cpu.h>
+#include <kern/trace.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -38,6 +42,28 @@ sys_cgetc(void)
 	return cons_getc();
 }
 
+// Read up to 'len' bytes of console input into buf, blocking until
+// there is some.  Returns the number of bytes read.  A reader woken by
+// new input returns 0, and the library stub calls again, since another
+// env may have taken the input first.  Destroys the environment if buf
+// is not writable.
+static int
+sys_cons_read(char *buf, size_t len)
+{
+    size_t n;
+
+    user_mem_assert(curenv, buf, len, PTE_U | PTE_W);
+    if (len == 0)
+        return 0;
+    if ((n = cons_read(buf, len)) > 0)
+        return n;
+
+    cons_wait(curenv);
+    curenv->env_tf.tf_regs.reg_eax = 0;
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    sched_yield(); // no return
+}
+
 // Returns the current environment's envid.
 static envid_t
 sys_getenvid(void)
@@ -69,6 +95,46 @@ sys_yield(void)
 	sched_yield();
 }
 
+// Timer callback: the sleep or timed receive of the env owning 't' is
+// over.  A receive that times out returns -E_TIMEOUT; a sleep returns 0.
+static void
+env_timeout(struct Timer *t)
+{
+    struct Env *e = (struct Env *) ((char *) t - offsetof(struct Env, env_timer));
+
+    if (e->env_status != ENV_NOT_RUNNABLE)
+        return;
+    if (e->env_ipc_recving) {
+        e->env_ipc_recving = 0;
+        e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+    }
+    e->env_status = ENV_RUNNABLE;
+    sched_wakeup(e);
+}
+
+// Arm the current environment's timer to wake it 'usec' microseconds
+// from now, rounded up to the next millisecond.
+static void
+env_timeout_arm(uint32_t usec)
+{
+    uint32_t ms = usec / 1000 + (usec % 1000 != 0);
+    timer_add(&curenv->env_timer, time_msec() + ms, env_timeout);
+}
+
+// Block the current environment for at least 'usec' microseconds.  It
+// is off the run queue until its timer fires.  Returns 0.
+static int
+sys_sleep(uint32_t usec)
+{
+    if (usec == 0)
+        return 0;
+
+    env_timeout_arm(usec);
+    curenv->env_tf.tf_regs.reg_eax = 0;
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    sched_yield(); // no return
+}
+
 // Allocate a new environment.
 // Returns envid of new environment, or < 0 on error.  Errors are:
 //	-E_NO_FREE_ENV if no free environment is available.
@@ -93,6 +159,14 @@ sys_exofork(void)
     e->env_tf = curenv->env_tf;
     e->env_tf.tf_regs.reg_eax = 0; // appear to return 0
 
+    e->env_affinity = curenv->env_affinity;
+
+    // children of a pinned env (e.g. the ns helpers) stay pinned
+    if (curenv->env_prio_pinned) {
+        e->env_prio_pinned = 1;
+        e->env_priority = curenv->env_priority;
+    }
+
     return e->env_id;
 }
 
@@ -122,10 +196,116 @@ sys_env_set_status(envid_t envid, int status)
         return -E_INVAL;
 
     e->env_status = status;
+    if (status == ENV_RUNNABLE)
+        sched_wakeup(e);
+
+    return 0;
+}
+
+// Set envid's scheduling priority.  A 'priority' in [0, NPRIO) pins the
+// env at that MLFQ level (0 is the highest), so it is never demoted or
+// boosted; ENV_PRIO_MLFQ returns it to feedback scheduling at level 0.
+// Only the file and network servers may pin an env above the lowest
+// level: for anyone else, a pin would be a way out of demotion.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid,
+//		or to pin it above level NPRIO - 1.
+//	-E_INVAL if priority is not a valid level or ENV_PRIO_MLFQ.
+static int
+sys_env_set_priority(envid_t envid, int priority)
+{
+    struct Env *e;
+    int r;
+    if ((r = envid2env(envid, &e, 1 /*checkperm*/)) < 0)
+        return r;
+
+    if (priority != ENV_PRIO_MLFQ && (priority < 0 || priority >= NPRIO))
+        return -E_INVAL;
+    if (priority != ENV_PRIO_MLFQ && priority < NPRIO - 1 &&
+            curenv->env_type != ENV_TYPE_FS && curenv->env_type != ENV_TYPE_NS)
+        return -E_BAD_ENV;
+
+    e->env_prio_pinned = priority != ENV_PRIO_MLFQ;
+    e->env_priority = e->env_prio_pinned ? priority : 0;
+    e->env_ticks = 0;
+
+    return 0;
+}
+
+// Set the CPUs envid may run on: bit i of 'mask' allows CPU i.  The
+// scheduler never runs envid on another CPU; if it is running on one
+// now, that CPU is told to reschedule right away, since a tickless CPU
+// might otherwise never look again.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if 'mask' allows none of the CPUs in the system.
+static int
+sys_env_set_affinity(envid_t envid, uint32_t mask)
+{
+    struct Env *e;
+    int r;
+    if ((r = envid2env(envid, &e, 1 /*checkperm*/)) < 0)
+        return r;
+
+    uint32_t online = ncpu >= 32 ? ENV_AFFINITY_ALL : (1U << ncpu) - 1;
+    if ((mask & online) == 0)
+        return -E_INVAL;
+
+    e->env_affinity = mask;
+
+    if (e->env_status == ENV_RUNNING && e->env_cpunum >= 0 &&
+            e->env_cpunum < ncpu && !((mask >> e->env_cpunum) & 1)) {
+        if (e == curenv) {
+            curenv->env_tf.tf_regs.reg_eax = 0;
+            sched_yield(); // no return
+        }
+        struct CpuInfo *c = &cpus[e->env_cpunum];
+        if (!c->cpu_resched) {
+            c->cpu_resched = 1;
+            lapic_ipi_cpu(c->cpu_id, IRQ_OFFSET + IRQ_RESCHED);
+        }
+    } else if (e->env_status == ENV_RUNNABLE)
+        sched_wakeup(e);
+
+    return 0;
+}
+
+// Set envid's share of the CPU under the stride policy: envs get CPU
+// time in proportion to their tickets.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if tickets is 0 or more than ENV_MAX_TICKETS.
+static int
+sys_env_set_tickets(envid_t envid, unsigned tickets)
+{
+    struct Env *e;
+    int r;
+    if ((r = envid2env(envid, &e, 1 /*checkperm*/)) < 0)
+        return r;
+
+    if (tickets == 0 || tickets > ENV_MAX_TICKETS)
+        return -E_INVAL;
+
+    e->env_tickets = tickets;
 
     return 0;
 }
 
+// Switch the scheduler to 'policy', SCHED_POLICY_MLFQ or
+// SCHED_POLICY_STRIDE.
+// Returns the previous policy, or -E_INVAL if policy is unknown.
+static int
+sys_sched_set_policy(int policy)
+{
+    return sched_set_policy(policy);
+}
+
 // Set envid's trap frame to 'tf'.
 // tf is modified to make sure that user environments always run at code
 // protection level 3 (CPL 3) with interrupts enabled.
@@ -151,6 +331,9 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	e->env_tf.tf_ss = GD_UD | 3;
 	e->env_tf.tf_cs = GD_UT | 3;
     e->env_tf.tf_eflags |= FL_IF;
+    // only a real sysenter may leave through sysexit (see env_pop_tf)
+    if (e->env_tf.tf_trapno == T_SYSENTER)
+        e->env_tf.tf_trapno = T_SYSCALL;
 
     return 0;
 }
@@ -190,6 +373,7 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
 //	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_INVAL if va is UVDSO, which the kernel owns.
 //	-E_INVAL if perm is inappropriate (see above).
 //	-E_NO_MEM if there's no memory to allocate the new page,
 //		or to allocate any necessary page tables.
@@ -210,7 +394,8 @@ sys_page_alloc(envid_t envid, void *va, int perm)
     if ((ret = envid2env(envid, &e, 1 /*checkperm*/)) < 0)
         return ret;
 
-    bool is_va_legal = (uintptr_t)va < UTOP || (uintptr_t)va % PGSIZE == 0;
+    bool is_va_legal = (uintptr_t)va < UTOP && (uintptr_t)va % PGSIZE == 0 &&
+        ROUNDDOWN((uintptr_t)va, PGSIZE) != UVDSO;
     bool is_perm_right = (perm & PTE_U) == PTE_U && (perm & PTE_P) == PTE_P &&
         (perm & ~PTE_SYSCALL) == 0;
 
@@ -240,6 +425,7 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 //		or the caller doesn't have permission to change one of them.
 //	-E_INVAL if srcva >= UTOP or srcva is not page-aligned,
 //		or dstva >= UTOP or dstva is not page-aligned.
+//	-E_INVAL if dstva is UVDSO, which the kernel owns.
 //	-E_INVAL is srcva is not mapped in srcenvid's address space.
 //	-E_INVAL if perm is inappropriate (see sys_page_alloc).
 //	-E_INVAL if (perm & PTE_W), but srcva is read-only in srcenvid's
@@ -269,7 +455,8 @@ sys_page_map(envid_t srcenvid, void *srcva,
     bool is_src_va_legal = (uintptr_t)srcva < UTOP &&
         (uintptr_t)srcva % PGSIZE == 0;
     bool is_dst_va_legal = (uintptr_t)dstva < UTOP &&
-        (uintptr_t)dstva % PGSIZE == 0;
+        (uintptr_t)dstva % PGSIZE == 0 &&
+        ROUNDDOWN((uintptr_t)dstva, PGSIZE) != UVDSO;
     bool is_perm_right = (perm & PTE_U) == PTE_U && (perm & PTE_P) == PTE_P &&
         (perm & ~PTE_SYSCALL) == 0;
 
@@ -298,6 +485,7 @@ sys_page_map(envid_t srcenvid, void *srcva,
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
 //	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_INVAL if va is UVDSO, which the kernel owns.
 static int
 sys_page_unmap(envid_t envid, void *va)
 {
@@ -309,7 +497,8 @@ sys_page_unmap(envid_t envid, void *va)
     if ((ret = envid2env(envid, &e, 1 /*checkperm*/)) < 0)
         return ret;
 
-    bool is_va_legal = (uintptr_t)va < UTOP || (uintptr_t)va % PGSIZE == 0;
+    bool is_va_legal = (uintptr_t)va < UTOP && (uintptr_t)va % PGSIZE == 0 &&
+        ROUNDDOWN((uintptr_t)va, PGSIZE) != UVDSO;
     if (!is_va_legal)
         return -E_INVAL;
 
@@ -318,6 +507,188 @@ sys_page_unmap(envid_t envid, void *va)
     return 0;
 }
 
+// Check that the 'npages' pages in 'pages' may be sent by the current
+// environment: each must be page-aligned, below UTOP and mapped, with
+// perm as in sys_page_alloc, and writable if PTE_W is asked for.
+static int
+ipc_check_pages(const struct IpcPage *pages, unsigned npages)
+{
+    unsigned i;
+    for (i = 0; i < npages; i++) {
+        void *va = pages[i].ip_va;
+        int perm = pages[i].ip_perm;
+        bool is_src_va_legal = (uintptr_t)va < UTOP &&
+            (uintptr_t)va % PGSIZE == 0;
+        bool is_perm_right = (perm & PTE_U) == PTE_U && (perm & PTE_P) == PTE_P &&
+            (perm & ~PTE_SYSCALL) == 0;
+        if (!is_src_va_legal || !is_perm_right)
+            return -E_INVAL;
+
+        pte_t *entry;
+        if (page_lookup(curenv->env_pgdir, va, &entry) == NULL)
+            return -E_INVAL; // va is not mapped into src_env
+        if ((perm & PTE_W) == PTE_W && entry && (*entry & PTE_W) == 0)
+            return -E_INVAL;
+    }
+    return 0;
+}
+
+// Deliver 'value', and the 'npages' pages described by 'pages' in the
+// current environment, to 'dst_e'.  Page i is mapped at
+// dst_e->env_ipc_dstva + i * PGSIZE; pages beyond the receiver's window
+// are silently dropped, as with a single page sent to an env that does
+// not want one.  Either all pages in the window are mapped or none are.
+// This is the core of sys_ipc_try_send; see the comment there for the
+// checks and errors.
+static int
+ipc_deliver(struct Env *dst_e, uint32_t value, const struct IpcPage *pages,
+	    unsigned npages)
+{
+    int r;
+    unsigned i;
+
+    // dst env not blocked, or it is waiting for a reply from someone else
+    if (!dst_e->env_ipc_recving ||
+            (dst_e->env_ipc_from != 0 && dst_e->env_ipc_from != curenv->env_id))
+        return -E_IPC_NOT_RECV;
+
+    if (npages > dst_e->env_ipc_dstnpages)
+        npages = dst_e->env_ipc_dstnpages;
+
+    if ((r = ipc_check_pages(pages, npages)) < 0)
+        return r;
+
+    // Allocate the page tables first, which is all that can fail, so
+    // a failure leaves the receiver's mappings as they were.
+    char *dstva = dst_e->env_ipc_dstva;
+    for (i = 0; i < npages; i++)
+        if (!pgdir_walk(dst_e->env_pgdir, dstva + i * PGSIZE, 1))
+            return -E_NO_MEM;
+    for (i = 0; i < npages; i++) {
+        struct PageInfo *page = page_lookup(curenv->env_pgdir,
+                pages[i].ip_va, NULL);
+        r = page_insert(dst_e->env_pgdir, page, dstva + i * PGSIZE,
+                        pages[i].ip_perm);
+        assert(r == 0);
+    }
+
+    // a reply to dst's ipc_call ends its donation to us
+    if (dst_e->env_ipc_donee == curenv)
+        sched_undonate(dst_e);
+
+    dst_e->env_ipc_recving = 0;
+    dst_e->env_ipc_from = curenv->env_id;
+    dst_e->env_ipc_value = value;
+    dst_e->env_ipc_perm = npages ? pages[0].ip_perm : 0;
+    dst_e->env_ipc_npages = npages;
+    dst_e->env_tf.tf_regs.reg_eax = 0;
+
+    TRACE(TRACE_IPC_SEND, curenv->env_id, dst_e->env_id, npages);
+    dst_e->env_status = ENV_RUNNABLE;
+    sched_wakeup(dst_e);
+    return 0;
+}
+
+// Tell 'e' that a device it drives has interrupted.  The notification
+// is a message from envid 0 with value 0 and no pages.  It is received
+// right away if e is receiving from anyone or in sys_notify_wait,
+// otherwise by e's next receive; notifications that pile up meanwhile
+// merge into one.
+void
+env_notify(struct Env *e)
+{
+    if (!e->env_ipc_recving ||
+            (e->env_ipc_from != 0 && e->env_ipc_from != e->env_id)) {
+        e->env_notify_pending = 1;
+        return;
+    }
+
+    e->env_ipc_recving = 0;
+    e->env_ipc_from = 0;
+    e->env_ipc_value = 0;
+    e->env_ipc_perm = 0;
+    e->env_ipc_npages = 0;
+    e->env_tf.tf_regs.reg_eax = 0;
+    e->env_status = ENV_RUNNABLE;
+    sched_wakeup(e);
+}
+
+// If a notification is pending for the current environment, receive it
+// instead of blocking.  Returns 1 if there was one.
+static bool
+ipc_take_notify(void)
+{
+    if (!curenv->env_notify_pending)
+        return 0;
+    curenv->env_notify_pending = 0;
+    curenv->env_ipc_from = 0;
+    curenv->env_ipc_value = 0;
+    curenv->env_ipc_perm = 0;
+    curenv->env_ipc_npages = 0;
+    return 1;
+}
+
+// Check that the receive window of 'npages' pages at 'dstva' is sane.
+// A window at or above UTOP means no pages are wanted.  The window may
+// not cover UVDSO, which the kernel owns.
+static int
+ipc_check_window(void *dstva, unsigned npages)
+{
+    if ((uintptr_t)dstva >= UTOP)
+        return 0;
+    if ((uintptr_t)dstva % PGSIZE != 0 || npages > IPC_MAXPAGES ||
+            (uintptr_t)dstva + npages * PGSIZE > UTOP)
+        return -E_INVAL;
+    if ((uintptr_t)dstva <= UVDSO &&
+            (uintptr_t)dstva + npages * PGSIZE > UVDSO)
+        return -E_INVAL;
+    return 0;
+}
+
+// Check that the user-supplied page vector 'vec' is readable and sane.
+// Returns the number of pages in it, read once, or -E_INVAL.
+static int
+ipc_check_vec(const struct IpcVec *vec)
+{
+    unsigned npages;
+
+    user_mem_assert(curenv, vec, sizeof(struct IpcVec), PTE_U);
+    if ((npages = vec->iv_npages) > IPC_MAXPAGES)
+        return -E_INVAL;
+    user_mem_assert(curenv, vec, IPC_VEC_SIZE(npages), PTE_U);
+    return npages;
+}
+
+// Block the current environment in an IPC receive into the window of
+// 'npages' pages at 'dstva'.
+// If 'from' is nonzero, only that environment may send to us; sends from
+// anyone else fail with -E_IPC_NOT_RECV (env_ipc_from doubles as the
+// filter while env_ipc_recving is set).
+// If 'next' is runnable and may run on this CPU, switch straight to it
+// instead of going through the scheduler: it gets the rest of our time
+// slice.  If its affinity rules this CPU out, leave it to a CPU it may
+// run on.
+static void
+ipc_wait(void *dstva, unsigned npages, envid_t from, struct Env *next)
+{
+    curenv->env_ipc_recving = 1;
+    curenv->env_ipc_from = from;
+    curenv->env_ipc_dstva = dstva;
+    curenv->env_ipc_dstnpages = (uintptr_t)dstva < UTOP ? npages : 0;
+    curenv->env_ipc_npages = 0;
+    TRACE(TRACE_IPC_RECV, curenv->env_id, from, 0);
+
+    curenv->env_status = ENV_NOT_RUNNABLE;
+    if (next && next->env_status == ENV_RUNNABLE) {
+        if (sched_allowed(next)) {
+            sched_blocked(curenv);
+            env_run(next); // no return
+        }
+        sched_wakeup(next);
+    }
+    sched_yield(); // no return
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
@@ -332,7 +703,8 @@ sys_page_unmap(envid_t envid, void *va)
 //    env_ipc_recving is set to 0 to block future sends;
 //    env_ipc_from is set to the sending envid;
 //    env_ipc_value is set to the 'value' parameter;
-//    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise.
+//    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise;
+//    env_ipc_npages is set to the number of pages transferred.
 // The target environment is marked runnable again, returning 0
 // from the paused sys_ipc_recv system call.  (Hint: does the
 // sys_ipc_recv function ever actually return?)
@@ -365,42 +737,8 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
     if ((r = envid2env(envid, &dst_e, 0 /*any env*/)) < 0)
         return r;
 
-    // dst env not blocked or another env managed to send first
-    if (!dst_e->env_ipc_recving ||
-            (dst_e->env_ipc_from != 0 && dst_e->env_ipc_from != curenv->env_id))
-        return -E_IPC_NOT_RECV;
-
-    void *dstva = dst_e->env_ipc_dstva;
-
-    bool page_transfered = 0;
-    if ((uintptr_t)srcva < UTOP && (uintptr_t)dstva < UTOP) {
-        /*panic("should not enter because srcva: %x and dstva: %x\n", srcva, dstva);*/
-        bool is_src_va_legal = (uintptr_t)srcva % PGSIZE == 0;
-        bool is_perm_right = (perm & PTE_U) == PTE_U && (perm & PTE_P) == PTE_P &&
-            (perm & ~PTE_SYSCALL) == 0;
-        if (!is_src_va_legal || !is_perm_right)
-            return -E_INVAL;
-
-        struct PageInfo *page;
-        pte_t *entry;
-        if ((page = page_lookup(curenv->env_pgdir, srcva, &entry)) == NULL)
-            return -E_INVAL; // srcva is not mapped into src_env
-        if ((perm & PTE_W) == PTE_W && entry && (*entry & PTE_W) == 0)
-            return -E_INVAL;
-
-        if ((r = page_insert(dst_e->env_pgdir, page, dstva, perm)) < 0)
-            return r;
-        page_transfered = 1;
-    }
-
-    dst_e->env_ipc_recving = 0;
-    dst_e->env_ipc_from = curenv->env_id;
-    dst_e->env_ipc_value = value;
-    dst_e->env_ipc_perm =  page_transfered ? perm : 0;
-    dst_e->env_tf.tf_regs.reg_eax = 0;
-
-    dst_e->env_status = ENV_RUNNABLE;
-    return 0;
+    struct IpcPage page = { srcva, perm };
+    return ipc_deliver(dst_e, value, &page, (uintptr_t)srcva < UTOP);
 }
 
 // Block until a value is ready.  Record that you want to receive
@@ -410,28 +748,111 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
+// If 'timeout' is nonzero, give up after that many microseconds.
+//
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned, or is UVDSO.
+//	-E_TIMEOUT if nothing arrived within 'timeout' microseconds.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, uint32_t timeout)
 {
 	// LAB 4: Your code here.
-    curenv->env_ipc_recving = 1;
-    curenv->env_ipc_from = 0;
-    if ((uintptr_t)dstva < UTOP && (uintptr_t)dstva % PGSIZE != 0)
-        return -E_INVAL;
+    int r;
+    if ((r = ipc_check_window(dstva, 1)) < 0)
+        return r;
 
-    if ((uintptr_t)dstva < UTOP)
-        curenv->env_ipc_dstva = dstva;
-
-    curenv->env_status = ENV_NOT_RUNNABLE;
-    sched_yield(); // no return
+    if (ipc_take_notify())
+        return 0;
+    if (timeout)
+        env_timeout_arm(timeout);
+    ipc_wait(dstva, 1, 0 /*from anyone*/, NULL); // no return
 
 	return 0;
 }
 
+// Send 'value' and the pages in 'vec' to 'envid', then block waiting
+// for the reply from that same environment, which may map up to
+// 'dstnpages' pages starting at 'dstva' (as sys_ipc_recv does for one).
+// Sends from any other environment are refused with -E_IPC_NOT_RECV
+// until the reply arrives, so the reply cannot be stolen or raced.
+// Page i of 'vec' is mapped at the target's env_ipc_dstva + i * PGSIZE,
+// with vec->iv_pages[i].ip_perm.
+//
+// This function only returns on error; on success the system call
+// returns 0 once the reply has been delivered.
+// Errors are those of sys_ipc_try_send for each page, plus:
+//	-E_INVAL if dstva < UTOP but the window is not page-aligned, is
+//		larger than IPC_MAXPAGES, extends above UTOP, or covers UVDSO.
+//	-E_INVAL if vec has more than IPC_MAXPAGES pages.
+//	-E_INVAL if envid is the calling environment.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, const struct IpcVec *vec,
+	     void *dstva, unsigned dstnpages)
+{
+    int r, npages;
+    struct Env *dst_e;
+    if ((r = envid2env(envid, &dst_e, 0 /*any env*/)) < 0)
+        return r;
+
+    if (dst_e == curenv)
+        return -E_INVAL; // would wait for a reply from ourselves forever
+    if ((r = ipc_check_window(dstva, dstnpages)) < 0)
+        return r;
+    if ((npages = ipc_check_vec(vec)) < 0)
+        return npages;
+
+    if ((r = ipc_deliver(dst_e, value, vec->iv_pages, npages)) < 0)
+        return r;
+
+    // Donate to the callee until it replies: it competes at our level
+    // when that is better than its own, on our quantum, and the callee
+    // runs out our time slice now (see sched_donate).
+    sched_donate(curenv, dst_e);
+    ipc_wait(dstva, dstnpages, dst_e->env_id, dst_e); // no return
+
+    return 0;
+}
+
+// Reply to 'whom' with 'value' and the pages in 'vec' (as in
+// sys_ipc_call), then block receiving the next message from anyone
+// into the window of 'dstnpages' pages at 'dstva'.  Both steps happen in
+// a single trap under the kernel lock, so a server loop never has a
+// window in which it is neither replying nor receiving.
+// If 'whom' is 0, there is nobody to reply to and only the receive is done.
+//
+// This function only returns on error; on success the system call
+// returns 0 once the next message has been delivered.
+// Errors are those of sys_ipc_call.
+// If the reply fails, nothing is received.
+static int
+sys_ipc_reply_wait(envid_t whom, uint32_t value, const struct IpcVec *vec,
+		   void *dstva, unsigned dstnpages)
+{
+    int r, npages;
+    struct Env *dst_e = NULL;
+
+    if ((r = ipc_check_window(dstva, dstnpages)) < 0)
+        return r;
+
+    if (whom != 0) {
+        if ((r = envid2env(whom, &dst_e, 0 /*any env*/)) < 0)
+            return r;
+        if ((npages = ipc_check_vec(vec)) < 0)
+            return npages;
+        if ((r = ipc_deliver(dst_e, value, vec->iv_pages, npages)) < 0)
+            return r;
+    }
+
+    if (ipc_take_notify())
+        return 0;
+    // hand the rest of our time slice back to the client we replied to
+    ipc_wait(dstva, dstnpages, 0 /*from anyone*/, dst_e); // no return
+
+    return 0;
+}
+
 // Return the current time.
 static int
 sys_time_msec(void)
@@ -440,6 +861,16 @@ sys_time_msec(void)
     return time_msec();
 }
 
+// Store the microseconds since boot in *usec.
+// Always returns 0; destroys the environment if usec is not writable.
+static int
+sys_time_usec(uint64_t *usec)
+{
+    user_mem_assert(curenv, usec, sizeof(*usec), PTE_U | PTE_W);
+    *usec = time_usec();
+    return 0;
+}
+
 static void
 net_intr_handler(bool is_read, envid_t id)
 {
@@ -455,6 +886,7 @@ net_intr_handler(bool is_read, envid_t id)
     // Wake up blocked envs and let them retry.
     e->env_tf.tf_regs.reg_eax = -E_NET_RETRY;
     e->env_status = ENV_RUNNABLE;
+    sched_wakeup(e);
 }
 
 static int
@@ -496,9 +928,214 @@ sys_recv_packets(char *data, int *len, bool wait)
     return 0;
 }
 
+// Run the system calls queued in 'ring' (see inc/syscall.h), so that a
+// run of independent calls costs one kernel entry.  Only calls that
+// neither block nor read user memory may be batched; any other entry
+// fails with -E_INVAL.
+//
+// Returns 0 if every entry succeeded, otherwise the error of the first
+// entry that failed.  Also returns
+//	-E_INVAL if the ring claims to hold more than BATCH_NENT entries.
+//	-E_FAULT if an entry unmapped the ring (its result is lost).
+// Destroys the environment if the ring is not writable.
+static int
+sys_batch(struct BatchRing *ring)
+{
+    struct BatchEntry *be;
+    uint32_t head;
+    int r;
+
+    user_mem_assert(curenv, ring, sizeof(*ring), PTE_U | PTE_W);
+    head = ring->br_head;
+    if (head - ring->br_tail > BATCH_NENT)
+        return -E_INVAL;
+
+    while (ring->br_tail != head) {
+        be = &ring->br_ent[ring->br_tail % BATCH_NENT];
+        switch (be->be_num) {
+        case SYS_page_alloc:
+        case SYS_page_map:
+        case SYS_page_unmap:
+        case SYS_env_set_status:
+        case SYS_env_set_pgfault_upcall:
+        case SYS_env_set_priority:
+        case SYS_env_set_affinity:
+        case SYS_env_set_tickets:
+            r = syscall(be->be_num, be->be_args[0], be->be_args[1],
+                        be->be_args[2], be->be_args[3], be->be_args[4]);
+            break;
+        default:
+            r = -E_INVAL;
+            break;
+        }
+
+        if (user_mem_check(curenv, ring, sizeof(*ring), PTE_U | PTE_W) < 0)
+            return -E_FAULT;
+        be->be_ret = r;
+        ring->br_tail++;
+        if (r < 0)
+            return r;
+        intr_window();
+    }
+    return 0;
+}
+
+// System call statistics, kept per CPU so that recording them touches
+// no cache line another CPU writes.
+static struct SyscallStat syscall_stats[NCPU][NSYSCALLS];
+
+static const char *const syscall_names[NSYSCALLS] = {
+	[SYS_cputs] = "cputs",
+	[SYS_cgetc] = "cgetc",
+	[SYS_getenvid] = "getenvid",
+	[SYS_env_destroy] = "env_destroy",
+	[SYS_page_alloc] = "page_alloc",
+	[SYS_page_map] = "page_map",
+	[SYS_page_unmap] = "page_unmap",
+	[SYS_exofork] = "exofork",
+	[SYS_env_set_status] = "env_set_status",
+	[SYS_env_set_trapframe] = "env_set_trapframe",
+	[SYS_env_set_pgfault_upcall] = "env_set_pgfault_upcall",
+	[SYS_yield] = "yield",
+	[SYS_ipc_try_send] = "ipc_try_send",
+	[SYS_ipc_recv] = "ipc_recv",
+	[SYS_time_msec] = "time_msec",
+	[SYS_send_packets] = "send_packets",
+	[SYS_recv_packets] = "recv_packets",
+	[SYS_ipc_call] = "ipc_call",
+	[SYS_ipc_reply_wait] = "ipc_reply_wait",
+	[SYS_env_set_priority] = "env_set_priority",
+	[SYS_env_set_affinity] = "env_set_affinity",
+	[SYS_env_set_tickets] = "env_set_tickets",
+	[SYS_sched_set_policy] = "sched_set_policy",
+	[SYS_time_usec] = "time_usec",
+	[SYS_sleep] = "sleep",
+	[SYS_batch] = "batch",
+	[SYS_syscall_stats] = "syscall_stats",
+	[SYS_cons_log] = "cons_log",
+	[SYS_cons_read] = "cons_read",
+	[SYS_page_pa] = "page_pa",
+	[SYS_ide_dma_base] = "ide_dma_base",
+	[SYS_notify_wait] = "notify_wait",
+};
+
+const char *
+syscall_name(uint32_t num)
+{
+	if (num >= NSYSCALLS || !syscall_names[num])
+		return "unknown";
+	return syscall_names[num];
+}
+
+// Add up every CPU's statistics into stats[0..NSYSCALLS-1], and
+// then clear them if 'reset'.
+void
+syscall_stats_get(struct SyscallStat *stats, bool reset)
+{
+	int c, n, i, j;
+
+	memset(stats, 0, NSYSCALLS * sizeof(*stats));
+	for (c = 0; c < ncpu; c++)
+		for (n = 0; n < NSYSCALLS; n++) {
+			struct SyscallStat *ss = &syscall_stats[c][n];
+			for (i = 0; i < ENV_NTYPES; i++) {
+				stats[n].ss_count[i] += ss->ss_count[i];
+				stats[n].ss_cycles[i] += ss->ss_cycles[i];
+				for (j = 0; j < SYSSTAT_NHIST; j++)
+					stats[n].ss_hist[i][j] += ss->ss_hist[i][j];
+			}
+		}
+	if (reset)
+		memset(syscall_stats, 0, sizeof(syscall_stats));
+}
+
+// Copy the system call statistics, summed over all CPUs, to
+// stats[0..NSYSCALLS-1], unless stats is NULL; then clear them if
+// 'reset'.  Only the file and network servers may clear them; anyone
+// else must use the monitor's "syscalls reset".
+// Returns NSYSCALLS on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if 'reset' and the environment is not a server.
+// Destroys the environment if stats is not writable.
+static int
+sys_syscall_stats(struct SyscallStat *stats, bool reset)
+{
+    static struct SyscallStat sum[NSYSCALLS];
+
+    if (reset &&
+        curenv->env_type != ENV_TYPE_FS && curenv->env_type != ENV_TYPE_NS)
+        return -E_BAD_ENV;
+    if (stats)
+        user_mem_assert(curenv, stats, sizeof(sum), PTE_U | PTE_W);
+    syscall_stats_get(sum, reset);
+    if (stats)
+        memmove(stats, sum, sizeof(sum));
+    return NSYSCALLS;
+}
+
+// Copy the most recent console output, up to len bytes, into buf.
+// Returns the number of bytes copied; destroys the environment if buf
+// is not writable.
+static int
+sys_cons_log(char *buf, size_t len)
+{
+    user_mem_assert(curenv, buf, len, PTE_U | PTE_W);
+    return cons_log_read(buf, len);
+}
+
+// Return the physical address of the byte at 'va' in the current
+// environment, so that the file server can point the disk's DMA engine
+// at its own pages.
+//
+// Returns the physical address on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if the environment is not the file server.
+//	-E_INVAL if va >= UTOP, or va is not mapped.
+static int
+sys_page_pa(void *va)
+{
+    struct PageInfo *pp;
+
+    if (curenv->env_type != ENV_TYPE_FS)
+        return -E_BAD_ENV;
+    if ((uintptr_t) va >= UTOP)
+        return -E_INVAL;
+    if ((pp = page_lookup(curenv->env_pgdir, va, NULL)) == NULL)
+        return -E_INVAL;
+    return page2pa(pp) + PGOFF(va);
+}
+
+// Return the I/O port base of the IDE controller's bus-master DMA
+// registers.  From now on the disk's interrupts are passed on to the
+// caller with env_notify().
+//
+// Returns the port on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if the environment is not the file server.
+//	-E_NOT_SUPP if there is no bus-master IDE controller.
+static int
+sys_ide_dma_base(void)
+{
+    if (curenv->env_type != ENV_TYPE_FS)
+        return -E_BAD_ENV;
+    return ide_dma_base(curenv->env_id);
+}
+
+// Block until the kernel notifies the current environment (see
+// env_notify), refusing sends from other environments meanwhile.
+//
+// This function only returns once the notification has arrived; the
+// system call then returns 0.
+static int
+sys_notify_wait(void)
+{
+    if (ipc_take_notify())
+        return 0;
+    // No env can send to us from ourselves, so only env_notify gets in.
+    ipc_wait((void *) UTOP, 0, curenv->env_id, NULL); // no return
+    return 0;
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
-int32_t
-syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+static int32_t
+syscall_dispatch(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	// Call the function corresponding to the 'syscallno' parameter.
 	// Return any appropriate return value.
@@ -533,9 +1170,39 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
     case SYS_ipc_try_send:
         return (int32_t) sys_ipc_try_send((envid_t)a1, (uint32_t)a2, (void*)a3, (unsigned)a4);
     case SYS_ipc_recv:
-        return (int32_t) sys_ipc_recv((void*)a1);
+        return (int32_t) sys_ipc_recv((void*)a1, (uint32_t)a2);
+    case SYS_ipc_call:
+        return (int32_t) sys_ipc_call((envid_t)a1, (uint32_t)a2, (const struct IpcVec *)a3, (void *)a4, (unsigned)a5);
+    case SYS_env_set_tickets:
+        return (int32_t) sys_env_set_tickets((envid_t)a1, (unsigned)a2);
+    case SYS_sched_set_policy:
+        return (int32_t) sys_sched_set_policy((int)a1);
+    case SYS_env_set_affinity:
+        return (int32_t) sys_env_set_affinity((envid_t)a1, (uint32_t)a2);
+    case SYS_env_set_priority:
+        return (int32_t) sys_env_set_priority((envid_t)a1, (int)a2);
+    case SYS_ipc_reply_wait:
+        return (int32_t) sys_ipc_reply_wait((envid_t)a1, (uint32_t)a2, (const struct IpcVec *)a3, (void *)a4, (unsigned)a5);
     case SYS_time_msec:
         return (int32_t) sys_time_msec();
+    case SYS_sleep:
+        return (int32_t) sys_sleep((uint32_t)a1);
+    case SYS_batch:
+        return (int32_t) sys_batch((struct BatchRing *)a1);
+    case SYS_syscall_stats:
+        return (int32_t) sys_syscall_stats((struct SyscallStat *)a1, (bool)a2);
+    case SYS_cons_log:
+        return (int32_t) sys_cons_log((char *)a1, (size_t)a2);
+    case SYS_cons_read:
+        return (int32_t) sys_cons_read((char *)a1, (size_t)a2);
+    case SYS_page_pa:
+        return (int32_t) sys_page_pa((void *)a1);
+    case SYS_ide_dma_base:
+        return (int32_t) sys_ide_dma_base();
+    case SYS_notify_wait:
+        return (int32_t) sys_notify_wait();
+    case SYS_time_usec:
+        return (int32_t) sys_time_usec((uint64_t *)a1);
     case SYS_send_packets:
         return (int32_t) sys_send_packets((void *)a1, (int)a2);
     case SYS_recv_packets:
@@ -547,3 +1214,25 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
     return 0;
 }
 
+// Make system call 'syscallno', recording it in this CPU's statistics.
+int32_t
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct SyscallStat *ss;
+	uint64_t start, t;
+	int32_t r;
+	int type;
+
+	if (syscallno >= NSYSCALLS)
+		return -E_INVAL;
+
+	ss = &syscall_stats[cpunum()][syscallno];
+	type = curenv->env_type;
+	ss->ss_count[type]++;
+	start = read_tsc();
+	r = syscall_dispatch(syscallno, a1, a2, a3, a4, a5);
+	t = read_tsc() - start;
+	ss->ss_cycles[type] += t;
+	ss->ss_hist[type][t >> 31 ? SYSSTAT_NHIST - 1 : 31 - __builtin_clz((uint32_t) t | 1)]++;
+	return r;
+}
@@ -1,26 +1,55 @@
+#include <inc/x86.h>
+#include <inc/memlayout.h>
 #include <kern/time.h>
+#include <kern/cpu.h>
+#include <kern/kclock.h>
 #include <inc/assert.h>
 
-static unsigned int ticks;
+// The clock is the TSC, which keeps counting whether or not any timer
+// interrupts arrive, so CPUs can run tickless.
+#define CALIBRATE_MS	50
 
+// The clock parameters.  env_alloc() copies them into every
+// environment's struct Vdso so user programs can read the clock too.
+struct ClockInfo clockinfo;
+
+// Calibrate the TSC and the LAPIC timer against the PIT.  Must be called
+// after lapic_init() on the boot CPU.
 void
 time_init(void)
 {
-	ticks = 0;
+	uint64_t tsc;
+	uint32_t counts;
+
+	lapic_timer_freerun();
+	counts = lapic_timer_count();
+	tsc = read_tsc();
+	pit_delay(CALIBRATE_MS);
+	tsc = read_tsc() - tsc;
+	counts -= lapic_timer_count();
+	lapic_timer_calibrate(counts / CALIBRATE_MS);
+
+	clockinfo.ci_tsc_hz = tsc * (1000 / CALIBRATE_MS);
+	if (clockinfo.ci_tsc_hz <= 1000000)
+		clockinfo.ci_tsc_hz = 1000000000;	// guess 1 GHz
+	clockinfo.ci_usec_mult = (1000000ULL << 32) / clockinfo.ci_tsc_hz;
+	clockinfo.ci_tsc_boot = read_tsc();
 }
 
-// This should be called once per timer interrupt.  A timer interrupt
-// fires every 10 ms.
-void
-time_tick(void)
+// Microseconds since boot.  Multiply the high and low halves of the
+// cycle count separately so the product cannot overflow however long
+// we have been up.  lib/time.c does the same arithmetic.
+uint64_t
+time_usec(void)
 {
-	ticks++;
-	if (ticks * 10 < ticks)
-		panic("time_tick: time overflowed");
+	uint64_t t = read_tsc() - clockinfo.ci_tsc_boot;
+	uint32_t mult = clockinfo.ci_usec_mult;
+
+	return (t >> 32) * mult + (((t & 0xffffffff) * mult) >> 32);
 }
 
 unsigned int
 time_msec(void)
 {
-	return ticks * 10;
+	return time_usec() / 1000;
 }
@@ -4,8 +4,12 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/memlayout.h>
+
+extern struct ClockInfo clockinfo;
+
 void time_init(void);
-void time_tick(void);
+uint64_t time_usec(void);
 unsigned int time_msec(void);
 
 #endif /* JOS_KERN_TIME_H */
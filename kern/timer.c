@@ -0,0 +1,178 @@
+// Kernel timers on a hierarchical timing wheel.
+//
+// Level L of the wheel has WHEEL_SLOTS slots, each covering
+// 1 << (L * WHEEL_BITS) milliseconds.  A timer due within WHEEL_SLOTS
+// ms of wheel_now sits in the level-0 slot for its exact millisecond;
+// one due later sits in the slot of the coarsest level that can tell it
+// apart, and moves down a level whenever wheel_now reaches the start of
+// that slot.  Adding and cancelling a timer are O(1), and timer_run
+// does O(1) work per millisecond plus the work of the timers it fires.
+//
+// The wheel is shared by all CPUs and protected by the big kernel lock.
+// Whichever CPU takes the next timer interrupt runs it (see sched_arm).
+
+#include <inc/types.h>
+#include <inc/assert.h>
+#include <kern/timer.h>
+#include <kern/time.h>
+
+#define WHEEL_BITS	6
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+// Timers further off than this (about 4.6 hours) wait in the last slot
+// and are re-filed when it comes round.
+#define WHEEL_SPAN	(1U << (WHEEL_BITS * WHEEL_LEVELS))
+
+static struct Timer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint32_t wheel_now;	// The next millisecond timer_run handles
+static unsigned wheel_count;	// Pending timers
+
+// File 't' in the slot for its deadline, relative to wheel_now.
+static void
+wheel_insert(struct Timer *t)
+{
+	uint32_t delta = t->tm_expires - wheel_now;
+	uint32_t at;
+	struct Timer **slot;
+	int level = 0;
+
+	if ((int32_t) delta < 0)
+		delta = 0;		// overdue: fire on the next run
+	if (delta >= WHEEL_SPAN)
+		delta = WHEEL_SPAN - 1;
+	at = wheel_now + delta;
+	while (delta >= (1U << (WHEEL_BITS * (level + 1))))
+		level++;
+
+	slot = &wheel[level][(at >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	t->tm_next = *slot;
+	if (*slot)
+		(*slot)->tm_pprev = &t->tm_next;
+	t->tm_pprev = slot;
+	*slot = t;
+	wheel_count++;
+}
+
+// Take every timer out of 'slot' and return them as a list.
+static struct Timer *
+wheel_take(struct Timer **slot)
+{
+	struct Timer *list = *slot, *t;
+
+	*slot = NULL;
+	for (t = list; t; t = t->tm_next) {
+		t->tm_pprev = NULL;
+		wheel_count--;
+	}
+	return list;
+}
+
+// Arrange for 'fn' to be called with 't' once time_msec() reaches
+// 'expires'.  If 't' is already pending, it is moved to the new time.
+void
+timer_add(struct Timer *t, uint32_t expires, void (*fn)(struct Timer *))
+{
+	uint32_t now = time_msec();
+
+	timer_cancel(t);
+	// An empty wheel does not run; catch it up first.
+	if (!wheel_count)
+		wheel_now = now;
+	t->tm_expires = expires;
+	t->tm_fn = fn;
+	wheel_insert(t);
+}
+
+// Stop 't' if it is pending.  Harmless if it is not.
+void
+timer_cancel(struct Timer *t)
+{
+	if (!t->tm_pprev)
+		return;
+	if (t->tm_next)
+		t->tm_next->tm_pprev = t->tm_pprev;
+	*t->tm_pprev = t->tm_next;
+	t->tm_pprev = NULL;
+	wheel_count--;
+}
+
+// Fire every timer that is due, advancing the wheel to time_msec().
+void
+timer_run(void)
+{
+	uint32_t now = time_msec();
+	struct Timer *t, *next;
+	int level;
+
+	while ((int32_t) (now - wheel_now) >= 0) {
+		if (!wheel_count) {
+			wheel_now = now + 1;
+			break;
+		}
+
+		// At the start of a slot of a coarser level, move its timers
+		// down to the finer levels.
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			unsigned idx;
+			if (wheel_now & ((1U << (WHEEL_BITS * level)) - 1))
+				break;
+			idx = (wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			for (t = wheel_take(&wheel[level][idx]); t; t = next) {
+				next = t->tm_next;
+				wheel_insert(t);
+			}
+		}
+
+		for (t = wheel_take(&wheel[0][wheel_now & WHEEL_MASK]); t; t = next) {
+			next = t->tm_next;
+			if ((int32_t) (t->tm_expires - wheel_now) > 0)
+				wheel_insert(t);	// was beyond WHEEL_SPAN
+			else
+				t->tm_fn(t);
+		}
+		wheel_now++;
+	}
+}
+
+// Store in *when the time at which timer_run next has work to do: the
+// earliest level-0 deadline or the start of the earliest coarser slot
+// that must be moved down, whichever comes first.  Returns false if no
+// timers are pending.
+bool
+timer_next(uint32_t *when)
+{
+	bool found = 0;
+	int level;
+	unsigned k;
+
+	if (!wheel_count)
+		return 0;
+
+	for (k = 0; k < WHEEL_SLOTS; k++)
+		if (wheel[0][(wheel_now + k) & WHEEL_MASK]) {
+			*when = wheel_now + k;
+			found = 1;
+			break;
+		}
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		int shift = WHEEL_BITS * level;
+		uint32_t base = wheel_now >> shift;
+
+		// The current slot is still to be moved down if wheel_now is
+		// at its start; otherwise it comes round again after a lap.
+		for (k = 0; k <= WHEEL_SLOTS; k++) {
+			if (k == 0 && (wheel_now & ((1U << shift) - 1)))
+				continue;
+			if (wheel[level][(base + k) & WHEEL_MASK]) {
+				uint32_t start = (base + k) << shift;
+				if (!found || (int32_t) (start - *when) < 0)
+					*when = start;
+				found = 1;
+				break;
+			}
+		}
+	}
+	return found;
+}
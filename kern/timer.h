@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+void timer_add(struct Timer *t, uint32_t expires, void (*fn)(struct Timer *));
+void timer_cancel(struct Timer *t);
+void timer_run(void);
+bool timer_next(uint32_t *when);
+
+#endif /* JOS_KERN_TIMER_H */
@@ -0,0 +1,68 @@
+// Kernel event tracing.
+//
+// Each CPU records events into its own ring, so recording takes no
+// lock and shares no cache lines.  The kernel runs with interrupts off
+// except at an intr_window, so nothing interrupts a CPU in
+// trace_event.  Printing with cprintf would be synchronous on the
+// console and distort the very timing being looked at, so the rings
+// are only dumped on request, from the kernel monitor.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/stdio.h>
+
+#include <kern/trace.h>
+#include <kern/cpu.h>
+#include <kern/time.h>
+
+uint32_t trace_mask;		// TRACE_BIT()s of the events to record
+
+struct TraceRing trace_rings[NCPU];
+
+void
+trace_event(int type, uint32_t a, uint32_t b, uint32_t c)
+{
+	int cpu = cpunum();
+	struct TraceRing *tr = &trace_rings[cpu];
+	struct TraceEvent *te = &tr->tr_events[tr->tr_head++ % TRACE_NEVENTS];
+
+	te->te_tsc = read_tsc();
+	te->te_type = type;
+	te->te_cpu = cpu;
+	te->te_a = a;
+	te->te_b = b;
+	te->te_c = c;
+}
+
+// Print the rings in the text form kern/tracedec.c reads: a header
+// with the TSC rate, then one line per event, oldest first on each CPU.
+// Alternatively, dump the memory at trace_rings (see
+// obj/kern/kernel.sym) from QEMU and give tracedec the rate and CPU
+// count.
+void
+trace_dump(void)
+{
+	struct TraceRing *tr;
+	struct TraceEvent *te;
+	uint32_t i;
+	int c;
+
+	cprintf("trace hz %llu ncpu %d\n", clockinfo.ci_tsc_hz, ncpu);
+	for (c = 0; c < ncpu; c++) {
+		tr = &trace_rings[c];
+		i = tr->tr_head > TRACE_NEVENTS ? tr->tr_head - TRACE_NEVENTS : 0;
+		for (; i != tr->tr_head; i++) {
+			te = &tr->tr_events[i % TRACE_NEVENTS];
+			cprintf("ev %d %llx %d %x %x %x\n", te->te_cpu,
+				te->te_tsc, te->te_type, te->te_a, te->te_b,
+				te->te_c);
+		}
+	}
+	cprintf("trace end\n");
+}
+
+void
+trace_clear(void)
+{
+	memset(trace_rings, 0, sizeof(trace_rings));
+}
@@ -0,0 +1,23 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trace.h>
+
+extern uint32_t trace_mask;
+
+void trace_event(int type, uint32_t a, uint32_t b, uint32_t c);
+void trace_dump(void);
+void trace_clear(void);
+
+// Record an event of 'type' if it is enabled.  A disabled tracepoint
+// costs a load and a test.
+#define TRACE(type, a, b, c)						\
+	do {								\
+		if (trace_mask & TRACE_BIT(type))			\
+			trace_event((type), (a), (b), (c));		\
+	} while (0)
+
+#endif /* JOS_KERN_TRACE_H */
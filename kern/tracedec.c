@@ -0,0 +1,218 @@
+/*
+ * Kernel trace decoder.  A host program, built as obj/kern/tracedec.
+ *
+ *	tracedec [file]
+ *		reads the output of the monitor's 'trace dump' (a whole
+ *		serial log will do; other lines are skipped);
+ *	tracedec -b file -hz tsc_hz -n ncpu
+ *		reads a raw copy of the kernel's trace_rings, e.g. from
+ *		QEMU's 'pmemsave <paddr of trace_rings> <size> file'.
+ *
+ * and prints the events of all CPUs as one timeline in microseconds.
+ * env_run lines also show how long the env waited: since the message
+ * that woke it was sent, or since it yielded.
+ */
+
+#define bool xxx_bool
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#undef bool
+
+// Prevent inc/types.h, included from inc/trace.h,
+// from attempting to redefine types defined in the host's inttypes.h.
+#define JOS_INC_TYPES_H
+typedef int bool;
+
+#include <inc/trace.h>
+
+#define ENVX(envid)	((envid) & 1023)
+
+static const char *names[NTRACE] = {
+	[TRACE_ENV_RUN] = "env_run",
+	[TRACE_SCHED_YIELD] = "sched_yield",
+	[TRACE_TRAP] = "trap",
+	[TRACE_IPC_SEND] = "ipc_send",
+	[TRACE_IPC_RECV] = "ipc_recv",
+	[TRACE_PGFAULT] = "pgfault",
+	[TRACE_NET_INTR] = "net_intr",
+	[TRACE_PAGE_ALLOC] = "page_alloc",
+	[TRACE_IDE_INTR] = "ide_intr",
+};
+
+static struct TraceEvent *events;
+static size_t nevents, maxevents;
+
+static void
+add_event(const struct TraceEvent *te)
+{
+	if (nevents == maxevents) {
+		maxevents = maxevents ? 2 * maxevents : 4096;
+		if (!(events = realloc(events, maxevents * sizeof(*events)))) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	events[nevents++] = *te;
+}
+
+static int
+by_tsc(const void *a, const void *b)
+{
+	const struct TraceEvent *x = a, *y = b;
+
+	return x->te_tsc < y->te_tsc ? -1 : x->te_tsc > y->te_tsc;
+}
+
+// Read 'trace dump' output; returns the TSC rate.
+static uint64_t
+read_text(FILE *f)
+{
+	char line[256];
+	uint64_t hz = 0;
+	int in = 0, ncpu;
+	unsigned cpu, type, a, b, c;
+	uint64_t tsc;
+	struct TraceEvent te;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "trace hz %" SCNu64 " ncpu %d", &hz, &ncpu) == 2)
+			in = 1;
+		else if (strncmp(line, "trace end", 9) == 0)
+			in = 0;
+		else if (in && sscanf(line, "ev %u %" SCNx64 " %u %x %x %x",
+				      &cpu, &tsc, &type, &a, &b, &c) == 6) {
+			te.te_tsc = tsc;
+			te.te_cpu = cpu;
+			te.te_type = type;
+			te.te_a = a;
+			te.te_b = b;
+			te.te_c = c;
+			add_event(&te);
+		}
+	}
+	return hz;
+}
+
+// Read a raw copy of 'ncpu' struct TraceRings.
+static void
+read_binary(FILE *f, int ncpu)
+{
+	static struct TraceRing tr;
+	uint32_t i;
+
+	while (ncpu-- > 0 && fread(&tr, sizeof(tr), 1, f) == 1) {
+		i = tr.tr_head > TRACE_NEVENTS ? tr.tr_head - TRACE_NEVENTS : 0;
+		for (; i != tr.tr_head; i++)
+			add_event(&tr.tr_events[i % TRACE_NEVENTS]);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: tracedec [file]\n"
+		"       tracedec -b file -hz tsc_hz -n ncpu\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	// when each env was last sent a message, and last yielded
+	static uint64_t sent[1024], yielded[1024];
+	const char *file = NULL;
+	int binary = 0, ncpu = 0;
+	uint64_t hz = 0, t0, t;
+	struct TraceEvent *te;
+	FILE *f = stdin;
+	size_t i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-b") == 0)
+			binary = 1;
+		else if (strcmp(argv[i], "-hz") == 0 && i + 1 < argc)
+			hz = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			ncpu = atoi(argv[++i]);
+		else if (argv[i][0] == '-' || file)
+			usage();
+		else
+			file = argv[i];
+	}
+	if (binary && (!file || !hz || !ncpu))
+		usage();
+	if (file && !(f = fopen(file, binary ? "rb" : "r"))) {
+		perror(file);
+		exit(1);
+	}
+
+	if (binary)
+		read_binary(f, ncpu);
+	else
+		hz = read_text(f);
+	if (!hz) {
+		fprintf(stderr, "tracedec: no 'trace hz' header\n");
+		exit(1);
+	}
+	if (!nevents)
+		return 0;
+
+	qsort(events, nevents, sizeof(*events), by_tsc);
+	t0 = events[0].te_tsc;
+	for (i = 0; i < nevents; i++) {
+		te = &events[i];
+		t = te->te_tsc - t0;
+		printf("%12.3f  cpu%-2u %-12s", (double) t * 1e6 / hz,
+		       te->te_cpu, te->te_type < NTRACE && names[te->te_type]
+		       ? names[te->te_type] : "?");
+
+		switch (te->te_type) {
+		case TRACE_ENV_RUN:
+			printf("%08x (was %08x)", te->te_a, te->te_b);
+			if (sent[ENVX(te->te_a)])
+				printf("  woken %.3f us ago",
+				       (double) (t - sent[ENVX(te->te_a)]) * 1e6 / hz);
+			else if (yielded[ENVX(te->te_a)])
+				printf("  yielded %.3f us ago",
+				       (double) (t - yielded[ENVX(te->te_a)]) * 1e6 / hz);
+			sent[ENVX(te->te_a)] = yielded[ENVX(te->te_a)] = 0;
+			break;
+		case TRACE_SCHED_YIELD:
+			printf("%08x", te->te_a);
+			if (te->te_a && !sent[ENVX(te->te_a)])
+				yielded[ENVX(te->te_a)] = t;
+			break;
+		case TRACE_TRAP:
+			printf("trapno %u eip %08x env %08x",
+			       te->te_a, te->te_b, te->te_c);
+			break;
+		case TRACE_IPC_SEND:
+			printf("%08x -> %08x, %u pages", te->te_a, te->te_b,
+			       te->te_c);
+			sent[ENVX(te->te_b)] = t;
+			break;
+		case TRACE_IPC_RECV:
+			printf("%08x waits for %08x", te->te_a, te->te_b);
+			break;
+		case TRACE_PGFAULT:
+			printf("va %08x eip %08x env %08x", te->te_a, te->te_b,
+			       te->te_c);
+			break;
+		case TRACE_NET_INTR:
+			printf("icr %08x", te->te_a);
+			break;
+		case TRACE_PAGE_ALLOC:
+			printf("pa %08x flags %x", te->te_a, te->te_b);
+			break;
+		case TRACE_IDE_INTR:
+			printf("notify %08x", te->te_a);
+			break;
+		default:
+			printf("%08x %08x %08x", te->te_a, te->te_b, te->te_c);
+		}
+		printf("\n");
+	}
+	return 0;
+}
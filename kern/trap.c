@@ -8,6 +8,7 @@
 #include <kern/monitor.h>
 #include <kern/env.h>
 #include <kern/e1000.h>
+#include <kern/ide.h>
 #include <kern/syscall.h>
 #include <kern/sched.h>
 #include <kern/kclock.h>
@@ -15,6 +16,9 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/work.h>
+#include <kern/prof.h>
+#include <kern/trace.h>
 
 static struct Taskstate ts;
 
@@ -60,7 +64,7 @@ static const char *trapname(int trapno)
 
 	if (trapno < ARRAY_SIZE(excnames))
 		return excnames[trapno];
-	if (trapno == T_SYSCALL)
+	if (trapno == T_SYSCALL || trapno == T_SYSENTER)
 		return "System call";
 	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
 		return "Hardware Interrupt";
@@ -69,6 +73,11 @@ static const char *trapname(int trapno)
 
 extern uint32_t vectors[];
 extern void syscall_handler();
+extern void sysenter_handler();
+extern void irq_resched();
+
+static void tick_bottom_half(struct Work *w);
+static struct Work tick_work[NCPU];
 
 void
 trap_init(void)
@@ -91,6 +100,7 @@ trap_init(void)
     }
 
     SETGATE(idt[T_SYSCALL], 0, GD_KT, (uint32_t) (&syscall_handler), 3);
+    SETGATE(idt[IRQ_OFFSET + IRQ_RESCHED], 0, GD_KT, (uint32_t) (&irq_resched), 0);
 
 	// Per-CPU setup
 	trap_init_percpu();
@@ -141,6 +151,103 @@ trap_init_percpu(void)
 
 	// Load the IDT
 	lidt(&idt_pd);
+
+	// Fast system calls: sysenter enters at sysenter_handler on this
+	// CPU's kernel stack.  sysexit returns to the user segments, which
+	// the GDT places 16 and 24 bytes after GD_KT.
+	if (cpu_has_sysenter()) {
+		wrmsr(MSR_SYSENTER_CS, GD_KT);
+		wrmsr(MSR_SYSENTER_ESP, thiscpu->cpu_ts.ts_esp0);
+		wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_handler);
+	}
+
+	tick_work[cpu_index].w_fn = tick_bottom_half;
+}
+
+// Kernel preemption points.
+//
+// The kernel runs with interrupts disabled, holding the big kernel lock.
+// Long operations call intr_window() at points where the interrupt top
+// halves in intr_nested() may safely run, so interrupts wait at most
+// the time between two such points instead of a whole system call.
+// The handlers only acknowledge their devices and queue work; anything
+// that reschedules waits until the kernel is about to leave (see the
+// end of trap(), and env_run()).
+void
+intr_window(void)
+{
+	intr_off_end();
+	asm volatile("sti; nop; cli" ::: "memory");
+	intr_off_begin();
+}
+
+// Record that interrupts were just disabled on this CPU.
+void
+intr_off_begin(void)
+{
+	thiscpu->cpu_intr_off_start = read_tsc();
+}
+
+// Record that interrupts are about to be enabled on this CPU, keeping
+// the longest time they were off, for the kernel monitor's intrlat.
+void
+intr_off_end(void)
+{
+	struct CpuInfo *c = thiscpu;
+	uint64_t t = read_tsc() - c->cpu_intr_off_start;
+
+	if (c->cpu_intr_off_start && t > c->cpu_intr_off_max)
+		c->cpu_intr_off_max = t;
+}
+
+// The timer fired at an intr_window: do the work of the timer
+// interrupt, and reschedule on the way out if it calls for it.
+static void
+tick_bottom_half(struct Work *w)
+{
+	if (sched_tick())
+		thiscpu->cpu_preempt = 1;
+}
+
+// Handle an interrupt taken in the kernel at an intr_window.  Only the
+// top halves run here.  The kernel state they may touch is limited to
+// device state, the console buffer and this CPU's work queue.
+static void
+intr_nested(struct Trapframe *tf)
+{
+	switch (tf->tf_trapno - IRQ_OFFSET) {
+	case IRQ_TIMER:
+		lapic_eoi();
+		prof_sample(tf);
+		work_queue(&tick_work[cpunum()]);
+		break;
+	case IRQ_RESCHED:
+		lapic_eoi();
+		thiscpu->cpu_resched = 0;
+		thiscpu->cpu_preempt = 1;
+		break;
+	case IRQ_KBD:
+		kbd_intr();
+		lapic_eoi();
+		break;
+	case IRQ_SERIAL:
+		serial_intr();
+		lapic_eoi();
+		break;
+	case IRQ_IDE:
+		ide_intr();
+		lapic_eoi();
+		break;
+	case IRQ_NETWORK:
+		network_intr();
+		lapic_eoi();
+		break;
+	case IRQ_SPURIOUS:
+		break;
+	default:
+		print_trapframe(tf);
+		panic("unexpected interrupt in kernel");
+	}
 }
 
 void
@@ -213,6 +320,17 @@ trap_dispatch(struct Trapframe *tf)
             tf->tf_regs.reg_esi);
         tf->tf_regs.reg_eax = sys_ret;
         return;
+    case T_SYSENTER:
+        // %esi held the return address, so there is no fifth argument
+        sys_ret = syscall(
+            tf->tf_regs.reg_eax,
+            tf->tf_regs.reg_edx,
+            tf->tf_regs.reg_ecx,
+            tf->tf_regs.reg_ebx,
+            tf->tf_regs.reg_edi,
+            0);
+        tf->tf_regs.reg_eax = sys_ret;
+        return;
     }
 
 	// Handle spurious interrupts
@@ -229,10 +347,16 @@ trap_dispatch(struct Trapframe *tf)
 	// LAB 4: Your code here.
     if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
         lapic_eoi();
-        // for lab 6. Always let cpu0 handle clock
-        if (cpunum() == 0) {
-            time_tick();
-        }
+        prof_sample(tf);
+        if (sched_tick())
+            sched_yield();
+        return;
+    }
+
+    // Another CPU made work runnable for us; see sched_wakeup.
+    if (tf->tf_trapno == IRQ_OFFSET + IRQ_RESCHED) {
+        lapic_eoi();
+        thiscpu->cpu_resched = 0;
         sched_yield();
     }
 
@@ -240,19 +364,28 @@ trap_dispatch(struct Trapframe *tf)
 	// Be careful! In multiprocessors, clock interrupts are
 	// triggered on every CPU.
 	// LAB 6: Your code here.
+	// (The clock is now the TSC; see kern/time.c.)
 
 
 	// Handle keyboard and serial interrupts.
 	// LAB 5: Your code here.
+    // Through the IOAPIC these need an EOI; acknowledge the NIC only
+    // after network_intr has cleared its (level-triggered) interrupt.
     if (tf->tf_trapno == IRQ_OFFSET + IRQ_KBD) {
         kbd_intr();
+        lapic_eoi();
         return;
     } else if (tf->tf_trapno == IRQ_OFFSET + IRQ_SERIAL) {
         serial_intr();
+        lapic_eoi();
         return;
-    } else if (tf->tf_trapno == IRQ_OFFSET + IRQ_NETWORK) {
+    } else if (tf->tf_trapno == IRQ_OFFSET + IRQ_IDE) {
+        ide_intr();
         lapic_eoi();
+        return;
+    } else if (tf->tf_trapno == IRQ_OFFSET + IRQ_NETWORK) {
         network_intr();
+        lapic_eoi();
         return;
     }
 
@@ -280,13 +413,24 @@ trap(struct Trapframe *tf)
 
 	// Re-acqurie the big kernel lock if we were halted in
 	// sched_yield()
-	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
+	bool halted = xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED;
+	if (halted)
 		lock_kernel();
 	// Check that interrupts are disabled.  If this assertion
 	// fails, DO NOT be tempted to fix it by inserting a "cli" in
 	// the interrupt path.
     assert(!(read_eflags() & FL_IF));
 
+	// An interrupt in the kernel, other than in the halt loop, came in
+	// at an intr_window.  Handle it and go back there; _alltraps
+	// resumes the kernel when trap returns.
+	if ((tf->tf_cs & 3) == 0 && !halted &&
+	    tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + 32) {
+		intr_nested(tf);
+		return;
+	}
+	intr_off_begin();
+
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
 		// Acquire the big kernel lock before doing any
@@ -294,6 +438,9 @@ trap(struct Trapframe *tf)
 		// LAB 4: Your code here.
         lock_kernel();
 
+		// Charge curenv for the time it ran since env_run.
+		sched_charge(curenv);
+
 		// Garbage collect if current enviroment is a zombie
 		if (curenv->env_status == ENV_DYING) {
 			env_free(curenv);
@@ -312,14 +459,19 @@ trap(struct Trapframe *tf)
 	// Record that tf is the last real trapframe so
 	// print_trapframe can print some additional information.
 	last_tf = tf;
+	TRACE(TRACE_TRAP, tf->tf_trapno, tf->tf_eip, curenv ? curenv->env_id : 0);
 
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
 
+	// Finish the work interrupt handlers deferred.
+	work_run();
+
 	// If we made it to this point, then no other environment was
 	// scheduled, so we should return to the current environment
-	// if doing so makes sense.
-	if (curenv && curenv->env_status == ENV_RUNNING)
+	// if doing so makes sense (and no interrupt asked for a
+	// reschedule).
+	if (curenv && curenv->env_status == ENV_RUNNING && !thiscpu->cpu_preempt)
 		env_run(curenv);
 	else
 		sched_yield();
@@ -333,6 +485,7 @@ page_fault_handler(struct Trapframe *tf)
 
 	// Read processor's CR2 register to find the faulting address
 	fault_va = rcr2();
+	TRACE(TRACE_PGFAULT, fault_va, tf->tf_eip, curenv ? curenv->env_id : 0);
 
 	// Handle kernel-mode page faults.
 
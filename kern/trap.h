@@ -19,5 +19,8 @@ void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 void page_fault_handler(struct Trapframe *);
 void backtrace(struct Trapframe *);
+void intr_window(void);
+void intr_off_begin(void);
+void intr_off_end(void);
 
 #endif /* JOS_KERN_TRAP_H */
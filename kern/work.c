@@ -0,0 +1,45 @@
+// Deferred interrupt work.
+//
+// An interrupt handler (the top half) only acknowledges its device and
+// records what happened, then queues a struct Work on this CPU.  The
+// work (the bottom half) runs on the way out of the kernel: in trap()
+// before returning to the interrupted env, or in sched_yield() before
+// choosing the next env, which is also where an idle CPU woken by the
+// interrupt ends up.
+
+#include <inc/assert.h>
+#include <kern/work.h>
+#include <kern/cpu.h>
+
+// Queue 'w' to run on this CPU.  Queueing work that is already queued
+// does nothing, so a burst of interrupts costs one run of the work.
+void
+work_queue(struct Work *w)
+{
+	struct CpuInfo *c = thiscpu;
+
+	if (w->w_queued)
+		return;
+	w->w_queued = 1;
+	w->w_next = NULL;
+	if (c->cpu_work)
+		*c->cpu_work_tail = w;
+	else
+		c->cpu_work = w;
+	c->cpu_work_tail = &w->w_next;
+}
+
+// Run all the work queued on this CPU, in the order it was queued,
+// including any work queued meanwhile.
+void
+work_run(void)
+{
+	struct CpuInfo *c = thiscpu;
+	struct Work *w;
+
+	while ((w = c->cpu_work) != NULL) {
+		c->cpu_work = w->w_next;
+		w->w_queued = 0;
+		w->w_fn(w);
+	}
+}
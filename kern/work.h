@@ -0,0 +1,21 @@
+#ifndef JOS_KERN_WORK_H
+#define JOS_KERN_WORK_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A piece of deferred interrupt work (a "bottom half").
+struct Work {
+	struct Work *w_next;		// Next item on the CPU's queue
+	bool w_queued;			// On a queue and not yet run
+	void (*w_fn)(struct Work *);	// The work itself
+};
+
+#define WORK_INIT(fn)	{ NULL, 0, (fn) }
+
+void work_queue(struct Work *w);
+void work_run(void);
+
+#endif /* JOS_KERN_WORK_H */
@@ -0,0 +1,87 @@
+// Batched system calls.
+//
+// The batch_* functions queue a system call in this environment's ring
+// at UBATCH instead of making it; batch_flush hands the whole queue to
+// the kernel in one sys_batch.  Queued calls take effect in order, but
+// only at the next flush, so callers must flush before depending on
+// their effects.
+
+#include <inc/lib.h>
+
+#define ring	((struct BatchRing *) UBATCH)
+
+// Queue system call 'num'.  Flushes first if the ring is full.
+// Returns 0, or the error of that flush.
+static int
+batch_add(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3,
+	  uint32_t a4, uint32_t a5)
+{
+	struct BatchEntry *be;
+	int r;
+
+	// Map the ring on first use.  A forked child starts without one.
+	if (!(uvpd[PDX(UBATCH)] & PTE_P) || !(uvpt[PGNUM(UBATCH)] & PTE_P)) {
+		if ((r = sys_page_alloc(0, (void *) UBATCH, PTE_P|PTE_U|PTE_W)) < 0)
+			return r;
+	}
+	if (ring->br_head - ring->br_tail == BATCH_NENT
+	    && (r = batch_flush()) < 0)
+		return r;
+
+	be = &ring->br_ent[ring->br_head % BATCH_NENT];
+	be->be_num = num;
+	be->be_args[0] = a1;
+	be->be_args[1] = a2;
+	be->be_args[2] = a3;
+	be->be_args[3] = a4;
+	be->be_args[4] = a5;
+	ring->br_head++;
+	return 0;
+}
+
+int
+batch_page_alloc(envid_t envid, void *va, int perm)
+{
+	return batch_add(SYS_page_alloc, envid, (uint32_t) va, perm, 0, 0);
+}
+
+int
+batch_page_map(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, int perm)
+{
+	return batch_add(SYS_page_map, srcenv, (uint32_t) srcva,
+			 dstenv, (uint32_t) dstva, perm);
+}
+
+int
+batch_page_unmap(envid_t envid, void *va)
+{
+	return batch_add(SYS_page_unmap, envid, (uint32_t) va, 0, 0, 0);
+}
+
+int
+batch_env_set_status(envid_t envid, int status)
+{
+	return batch_add(SYS_env_set_status, envid, status, 0, 0, 0);
+}
+
+int
+batch_env_set_pgfault_upcall(envid_t envid, void *upcall)
+{
+	return batch_add(SYS_env_set_pgfault_upcall, envid, (uint32_t) upcall, 0, 0, 0);
+}
+
+// Run every queued call.
+// Returns 0 if they all succeeded, otherwise the error of the first one
+// that failed; the calls queued after it are dropped.
+int
+batch_flush(void)
+{
+	int r;
+
+	if (!(uvpd[PDX(UBATCH)] & PTE_P) || !(uvpt[PGNUM(UBATCH)] & PTE_P)
+	    || ring->br_head == ring->br_tail)
+		return 0;
+	r = sys_batch(ring);
+	ring->br_tail = ring->br_head;
+	return r;
+}
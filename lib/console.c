@@ -78,19 +78,20 @@ opencons(void)
 static ssize_t
 devcons_read(struct Fd *fd, void *vbuf, size_t n)
 {
-	int c;
+	char *buf = vbuf;
+	int i, r;
 
 	if (n == 0)
 		return 0;
 
-	while ((c = sys_cgetc()) == 0)
-		sys_yield();
-	if (c < 0)
-		return c;
-	if (c == 0x04)	// ctl-d is eof
-		return 0;
-	*(char*)vbuf = c;
-	return 1;
+	// blocks in the kernel until input arrives; the kernel stops
+	// after a ctl-d, so nothing typed after it is lost
+	if ((r = sys_cons_read(buf, n)) < 0)
+		return r;
+	for (i = 0; i < r; i++)
+		if (buf[i] == 0x04)	// ctl-d is eof
+			return i;
+	return r;
 }
 
 static ssize_t
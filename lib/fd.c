@@ -158,12 +158,23 @@ close(int fdnum)
 		return fd_close(fd, 1);
 }
 
+// Close every open file descriptor.  The devices are closed one by one,
+// but the descriptor pages are all unmapped in a single batch.
 void
 close_all(void)
 {
 	int i;
-	for (i = 0; i < MAXFD; i++)
-		close(i);
+	struct Fd *fd;
+	struct Dev *dev;
+
+	for (i = 0; i < MAXFD; i++) {
+		if (fd_lookup(i, &fd) < 0)
+			continue;
+		if (dev_lookup(fd->fd_dev_id, &dev) >= 0 && dev->dev_close)
+			(void) (*dev->dev_close)(fd);
+		(void) batch_page_unmap(0, fd);
+	}
+	(void) batch_flush();
 }
 
 // Make file descriptor 'newfdnum' a duplicate of file descriptor 'oldfdnum'.
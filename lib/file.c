@@ -6,6 +6,8 @@
 
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 
+static envid_t fsenv;
+
 // Send an inter-environment request to the file server, and wait for
 // a reply.  The request body should be in fsipcbuf, and parts of the
 // response may be written back to fsipcbuf.
@@ -15,7 +17,6 @@ union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 static int
 fsipc(unsigned type, void *dstva)
 {
-	static envid_t fsenv;
 	if (fsenv == 0)
 		fsenv = ipc_find_env(ENV_TYPE_FS);
 
@@ -24,8 +25,62 @@ fsipc(unsigned type, void *dstva)
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	return ipc_call(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U,
+			dstva, NULL);
+}
+
+// Bounce buffer for the data of FSREQ_READ and FSREQ_WRITE, just below
+// the file descriptor table.  Its pages are lent to the file server
+// along with fsipcbuf, so one request can move FSREQ_MAXPAGES pages.
+#define FSDATA		((char *) (0xD0000000 - FSREQ_MAXPAGES * PGSIZE))
+
+// Make sure the first 'npages' pages of FSDATA are mapped and writable,
+// allocating them on first use and breaking copy-on-write after a fork.
+static int
+fsipc_map_data(unsigned npages)
+{
+	unsigned i;
+	int r;
+
+	for (i = 0; i < npages; i++) {
+		char *va = FSDATA + i * PGSIZE;
+		if (!(uvpd[PDX(va)] & PTE_P) || !(uvpt[PGNUM(va)] & PTE_P)) {
+			if ((r = sys_page_alloc(0, va, PTE_P | PTE_W | PTE_U)) < 0)
+				return r;
+		} else if (!(uvpt[PGNUM(va)] & PTE_W))
+			*(volatile char *) va = 0;
+	}
+	return 0;
+}
+
+// Like fsipc, but also send the first 'npages' pages of FSDATA, mapped
+// with 'perm', after fsipcbuf, and receive no page.
+static int
+fsipc_data(unsigned type, unsigned npages, int perm)
+{
+	IPC_VEC(1 + FSREQ_MAXPAGES) vec;
+	unsigned i;
+	int r;
+
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+
+	assert(npages <= FSREQ_MAXPAGES);
+	if ((r = fsipc_map_data(npages)) < 0)
+		return r;
+
+	vec.v.iv_npages = 1 + npages;
+	vec.v.iv_pages[0].ip_va = &fsipcbuf;
+	vec.v.iv_pages[0].ip_perm = PTE_P | PTE_W | PTE_U;
+	for (i = 0; i < npages; i++) {
+		vec.v.iv_pages[1 + i].ip_va = FSDATA + i * PGSIZE;
+		vec.v.iv_pages[1 + i].ip_perm = perm;
+	}
+
+	if (debug)
+		cprintf("[%08x] fsipc_data %d %d pages\n", thisenv->env_id, type, npages);
+
+	return ipc_callv(fsenv, type, &vec.v, NULL, 0, NULL);
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -113,17 +168,18 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 {
 	// Make an FSREQ_READ request to the file system server after
 	// filling fsipcbuf.read with the request arguments.  The
-	// bytes read will be written back to fsipcbuf by the file
+	// bytes read will be written into the FSDATA pages by the file
 	// system server.
 	int r;
 
+	n = MIN(n, FSREQ_MAXPAGES * PGSIZE);
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
 	fsipcbuf.read.req_n = n;
-	if ((r = fsipc(FSREQ_READ, NULL)) < 0)
+	if ((r = fsipc_data(FSREQ_READ, ROUNDUP(n, PGSIZE) / PGSIZE,
+			    PTE_P | PTE_W | PTE_U)) < 0)
 		return r;
 	assert(r <= n);
-	assert(r <= PGSIZE);
-	memmove(buf, fsipcbuf.readRet.ret_buf, r);
+	memmove(buf, FSDATA, r);
 	return r;
 }
 
@@ -137,17 +193,23 @@ static ssize_t
 devfile_write(struct Fd *fd, const void *buf, size_t n)
 {
 	// Make an FSREQ_WRITE request to the file system server.  Be
-	// careful: fsipcbuf.write.req_buf is only so large, but
+	// careful: FSDATA is only so large, but
 	// remember that write is always allowed to write *fewer*
 	// bytes than requested.
 	// LAB 5: Your code here
     int r;
 
+    n = MIN(n, FSREQ_MAXPAGES * PGSIZE);
     fsipcbuf.write.req_fileid = fd->fd_file.id;
     fsipcbuf.write.req_n = n;
-    memmove(fsipcbuf.write.req_buf, buf, n);
 
-    if ((r = fsipc(FSREQ_WRITE, NULL)) < 0)
+    // map the pages first, so the copy below lands in them
+    if ((r = fsipc_map_data(ROUNDUP(n, PGSIZE) / PGSIZE)) < 0)
+        return r;
+    memmove(FSDATA, buf, n);
+
+    if ((r = fsipc_data(FSREQ_WRITE, ROUNDUP(n, PGSIZE) / PGSIZE,
+                    PTE_P | PTE_U)) < 0)
         return r;
 
     assert(r <= n);
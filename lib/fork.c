@@ -78,9 +78,10 @@ duppage(envid_t envid, unsigned pn)
     if (require_cow)
         perm |= PTE_COW;
 
+    // Both mappings are only queued; fork flushes them with the rest.
     uintptr_t *addr = (uintptr_t*)(pn * PGSIZE);
-    if ((r = sys_page_map(0, addr, envid, addr, perm)) < 0)
-        panic("sys_page_map: %e", r);
+    if ((r = batch_page_map(0, addr, envid, addr, perm)) < 0)
+        panic("batch_page_map: %e", r);
 
     // make the addr copy-on-write again
     // The reason of this ordering (remapping COW after mapping into child)is
@@ -91,8 +92,8 @@ duppage(envid_t envid, unsigned pn)
     //
     // The reason we need to mark it COW again is that page could become writable
     // just as we are mapping into child.
-    if (require_cow && (r = sys_page_map(0, addr, 0, addr, perm)) < 0)
-        panic("sys_page_map: %e", r);
+    if (require_cow && (r = batch_page_map(0, addr, 0, addr, perm)) < 0)
+        panic("batch_page_map: %e", r);
 
 	return 0;
 }
@@ -137,14 +138,16 @@ fork(void)
         }
     }
 
-    if ((r = sys_env_set_pgfault_upcall(id, thisenv->env_pgfault_upcall)) < 0)
-        panic("sys_env_set_pgfault_upcall: %e", r);
-    if ((r = sys_page_alloc(id, (uintptr_t *)(UXSTACKTOP - PGSIZE), PTE_W | PTE_U | PTE_P)) < 0)
-        panic("sys_page_alloc for env %d: %e", id, r);
-
+    if ((r = batch_env_set_pgfault_upcall(id, thisenv->env_pgfault_upcall)) < 0)
+        panic("batch_env_set_pgfault_upcall: %e", r);
+    if ((r = batch_page_alloc(id, (uintptr_t *)(UXSTACKTOP - PGSIZE), PTE_W | PTE_U | PTE_P)) < 0)
+        panic("batch_page_alloc for env %d: %e", id, r);
+    if ((r = batch_env_set_status(id, ENV_RUNNABLE)) < 0)
+        panic("batch_env_set_status: %e", r);
 
-    if ((r = sys_env_set_status(id, ENV_RUNNABLE)) < 0)
-        panic("sys_env_set_status: %e", r);
+    // The whole address space goes over in a few kernel entries.
+    if ((r = batch_flush()) < 0)
+        panic("fork: %e", r);
 
     return id;
 }
@@ -65,6 +65,105 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
             r, thisenv->env_id, to_env, pg, perm);
 }
 
+// Send 'val' and the pages in 'vec' to 'to_env' and wait for its reply,
+// all in one system call.  Up to 'rcv_npages' pages of the reply are
+// mapped starting at 'rcv_pg' (none if 'rcv_pg' is null), and the number
+// actually received is stored in *npages_store if that is nonnull.
+// Only 'to_env' can deliver the reply.  This is the client half of a
+// server RPC.  Keeps retrying while 'to_env' is busy (not yet receiving).
+//
+// Returns the reply value, or < 0 if the call itself failed.
+int32_t
+ipc_callv(envid_t to_env, uint32_t val, const struct IpcVec *vec,
+	  void *rcv_pg, unsigned rcv_npages, unsigned *npages_store)
+{
+    assert(thisenv);
+    int r;
+    while ((r = sys_ipc_call(to_env, val, vec,
+                    (rcv_pg ? rcv_pg : (void *)ULIM), rcv_npages))
+            == -E_IPC_NOT_RECV)
+        sys_yield();
+
+    if (npages_store)
+        *npages_store = r < 0 ? 0 : thisenv->env_ipc_npages;
+    if (r < 0)
+        return r;
+
+    return thisenv->env_ipc_value;
+}
+
+// Reply to 'whom' with 'val' and the pages in 'vec', then receive the
+// next request into the window of 'rcv_npages' pages at 'rcv_pg', all in
+// one system call.  The sender and number of pages received are stored
+// in *from_env_store and *npages_store if those are nonnull.
+// A server loop alternates serving and ipc_reply_waitv.
+// If 'whom' is 0 there is nothing to reply to (e.g., the first request).
+// A 'whom' that has exited meanwhile is silently dropped; one that is
+// not receiving (a client that did not use ipc_call) is retried.
+//
+// Returns the next request value, or < 0 on error.
+int32_t
+ipc_reply_waitv(envid_t whom, uint32_t val, const struct IpcVec *vec,
+		envid_t *from_env_store, void *rcv_pg, unsigned rcv_npages,
+		unsigned *npages_store)
+{
+    assert(thisenv);
+    int r;
+    while (1) {
+        r = sys_ipc_reply_wait(whom, val, vec,
+                (rcv_pg ? rcv_pg : (void *)ULIM), rcv_npages);
+        if (r == -E_IPC_NOT_RECV)
+            sys_yield();
+        else if (r == -E_BAD_ENV && whom != 0)
+            whom = 0; // the client is gone, just receive
+        else
+            break;
+    }
+
+    if (from_env_store)
+        *from_env_store = r < 0 ? 0 : thisenv->env_ipc_from;
+    if (npages_store)
+        *npages_store = r < 0 ? 0 : thisenv->env_ipc_npages;
+    if (r < 0)
+        return r;
+
+    return thisenv->env_ipc_value;
+}
+
+// Single-page ipc_callv: send 'pg' with 'perm' (if 'pg' is nonnull) and
+// receive the reply as ipc_recv(NULL, rcv_pg, perm_store) would.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 void *rcv_pg, int *perm_store)
+{
+    IPC_VEC(1) vec;
+    vec.v.iv_npages = pg ? 1 : 0;
+    vec.v.iv_pages[0].ip_va = pg;
+    vec.v.iv_pages[0].ip_perm = perm;
+
+    int r = ipc_callv(to_env, val, &vec.v, rcv_pg, 1, NULL);
+    if (perm_store)
+        *perm_store = r < 0 ? 0 : thisenv->env_ipc_perm;
+    return r;
+}
+
+// Single-page ipc_reply_waitv: reply with 'pg' and 'perm' (if 'pg' is
+// nonnull) and receive as ipc_recv(from_env_store, rcv_pg, perm_store).
+int32_t
+ipc_reply_wait(envid_t whom, uint32_t val, void *pg, int perm,
+	       envid_t *from_env_store, void *rcv_pg, int *perm_store)
+{
+    IPC_VEC(1) vec;
+    vec.v.iv_npages = pg ? 1 : 0;
+    vec.v.iv_pages[0].ip_va = pg;
+    vec.v.iv_pages[0].ip_perm = perm;
+
+    int r = ipc_reply_waitv(whom, val, &vec.v, from_env_store, rcv_pg, 1, NULL);
+    if (perm_store)
+        *perm_store = r < 0 ? 0 : thisenv->env_ipc_perm;
+    return r;
+}
+
 // Find the first environment of the given type.  We'll use this to
 // find special environments.
 // Returns 0 if no such environment exists.
@@ -8,6 +8,8 @@
 #define REQVA		0x0ffff000
 union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
 
+static envid_t nsenv;
+
 // Send an IP request to the network server, and wait for a reply.
 // The request body should be in nsipcbuf, and parts of the response
 // may be written back to nsipcbuf.
@@ -16,7 +18,6 @@ union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
 static int
 nsipc(unsigned type)
 {
-	static envid_t nsenv;
 	if (nsenv == 0)
 		nsenv = ipc_find_env(ENV_TYPE_NS);
 
@@ -25,8 +26,61 @@ nsipc(unsigned type)
 	if (debug)
 		cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
 
-	ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
-	return ipc_recv(NULL, NULL, NULL);
+	return ipc_call(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U, NULL, NULL);
+}
+
+// Bounce buffer for the data of NSREQ_RECV and NSREQ_SEND, lent to the
+// network server along with nsipcbuf.  It sits just below the file
+// server's bounce buffer (FSDATA in file.c).
+#define NSDATA	((char *) (0xD0000000 - (FSREQ_MAXPAGES + NSREQ_MAXPAGES) * PGSIZE))
+
+// Make sure the first 'npages' pages of NSDATA are mapped and writable,
+// allocating them on first use and breaking copy-on-write after a fork.
+static int
+nsipc_map_data(unsigned npages)
+{
+	unsigned i;
+	int r;
+
+	for (i = 0; i < npages; i++) {
+		char *va = NSDATA + i * PGSIZE;
+		if (!(uvpd[PDX(va)] & PTE_P) || !(uvpt[PGNUM(va)] & PTE_P)) {
+			if ((r = sys_page_alloc(0, va, PTE_P|PTE_W|PTE_U)) < 0)
+				return r;
+		} else if (!(uvpt[PGNUM(va)] & PTE_W))
+			*(volatile char *) va = 0;
+	}
+	return 0;
+}
+
+// Like nsipc, but also send the first 'npages' pages of NSDATA, mapped
+// with 'perm', after nsipcbuf.
+static int
+nsipc_data(unsigned type, unsigned npages, int perm)
+{
+	IPC_VEC(1 + NSREQ_MAXPAGES) vec;
+	unsigned i;
+	int r;
+
+	if (nsenv == 0)
+		nsenv = ipc_find_env(ENV_TYPE_NS);
+
+	assert(npages <= NSREQ_MAXPAGES);
+	if ((r = nsipc_map_data(npages)) < 0)
+		return r;
+
+	vec.v.iv_npages = 1 + npages;
+	vec.v.iv_pages[0].ip_va = &nsipcbuf;
+	vec.v.iv_pages[0].ip_perm = PTE_P|PTE_W|PTE_U;
+	for (i = 0; i < npages; i++) {
+		vec.v.iv_pages[1 + i].ip_va = NSDATA + i * PGSIZE;
+		vec.v.iv_pages[1 + i].ip_perm = perm;
+	}
+
+	if (debug)
+		cprintf("[%08x] nsipc_data %d %d pages\n", thisenv->env_id, type, npages);
+
+	return ipc_callv(nsenv, type, &vec.v, NULL, 0, NULL);
 }
 
 int
@@ -90,13 +144,15 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags)
 {
 	int r;
 
+	len = MIN(len, NSREQ_MAXPAGES * PGSIZE);
 	nsipcbuf.recv.req_s = s;
 	nsipcbuf.recv.req_len = len;
 	nsipcbuf.recv.req_flags = flags;
 
-	if ((r = nsipc(NSREQ_RECV)) >= 0) {
-		assert(r < 1600 && r <= len);
-		memmove(mem, nsipcbuf.recvRet.ret_buf, r);
+	if ((r = nsipc_data(NSREQ_RECV, ROUNDUP(len, PGSIZE) / PGSIZE,
+			    PTE_P|PTE_W|PTE_U)) >= 0) {
+		assert(r <= len);
+		memmove(mem, NSDATA, r);
 	}
 
 	return r;
@@ -105,12 +161,21 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags)
 int
 nsipc_send(int s, const void *buf, int size, unsigned int flags)
 {
+	unsigned npages;
+	int r;
+
+	size = MIN(size, NSREQ_MAXPAGES * PGSIZE);
+	npages = ROUNDUP(size, PGSIZE) / PGSIZE;
 	nsipcbuf.send.req_s = s;
-	assert(size < 1600);
-	memmove(&nsipcbuf.send.req_buf, buf, size);
 	nsipcbuf.send.req_size = size;
 	nsipcbuf.send.req_flags = flags;
-	return nsipc(NSREQ_SEND);
+
+	// map the data pages first, so the copy lands in them
+	if ((r = nsipc_map_data(npages)) < 0)
+		return r;
+	memmove(NSDATA, buf, size);
+
+	return nsipc_data(NSREQ_SEND, npages, PTE_P|PTE_U);
 }
 
 int
@@ -307,11 +307,11 @@ copy_shared_pages(envid_t child)
         if ((uvpd[PDX(p)] & PTE_P) == PTE_P &&
             (uvpt[PGNUM(p)] & PTE_P) == PTE_P &&
             (uvpt[PGNUM(p)] & PTE_SHARE) == PTE_SHARE) {
-            if ((r = sys_page_map(0, (void *)p, child, (void *)p,
+            if ((r = batch_page_map(0, (void *)p, child, (void *)p,
                     PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
                 return r;
         }
     }
-	return 0;
+	return batch_flush();
 }
 
@@ -1,8 +1,20 @@
 // System call stubs.
 
+#include <inc/x86.h>
 #include <inc/syscall.h>
 #include <inc/lib.h>
 
+// Whether to enter the kernel with sysenter rather than int $T_SYSCALL.
+static bool
+use_sysenter(void)
+{
+	static int supported = -1;
+
+	if (supported < 0)
+		supported = cpu_has_sysenter();
+	return supported;
+}
+
 static inline int32_t
 syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
@@ -20,6 +32,26 @@ syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 	// potentially change the condition codes and arbitrary
 	// memory locations.
 
+	if (a5 == 0 && use_sysenter()) {
+		// Fast path: sysenter saves neither the stack nor where to
+		// come back, so hand them to the kernel in BP and SI; it
+		// returns with sysexit, which clobbers CX and DX.
+		// Calls that need a fifth parameter take the int path.
+		asm volatile("pushl %%ebp\n"
+			     "\tmovl %%esp, %%ebp\n"
+			     "\tleal 1f, %%esi\n"
+			     "\tsysenter\n"
+			     "1:\tpopl %%ebp\n"
+			     : "=a" (ret),
+			       "+d" (a1),
+			       "+c" (a2)
+			     : "a" (num),
+			       "b" (a3),
+			       "D" (a4)
+			     : "esi", "cc", "memory");
+		goto out;
+	}
+
 	asm volatile("int %1\n"
 		     : "=a" (ret)
 		     : "i" (T_SYSCALL),
@@ -31,6 +63,7 @@ syscall(int num, int check, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		       "S" (a5)
 		     : "cc", "memory");
 
+out:
 	if(check && ret > 0)
 		panic("syscall %d returned %d (> 0)", num, ret);
 
@@ -58,7 +91,8 @@ sys_env_destroy(envid_t envid)
 envid_t
 sys_getenvid(void)
 {
-	 return syscall(SYS_getenvid, 0, 0, 0, 0, 0, 0);
+	// No need to trap: the kernel keeps our envid at UVDSO.
+	return vdso.vd_envid;
 }
 
 void
@@ -105,6 +139,30 @@ sys_env_set_pgfault_upcall(envid_t envid, void *upcall)
 	return syscall(SYS_env_set_pgfault_upcall, 1, envid, (uint32_t) upcall, 0, 0, 0);
 }
 
+int
+sys_env_set_priority(envid_t envid, int priority)
+{
+	return syscall(SYS_env_set_priority, 1, envid, priority, 0, 0, 0);
+}
+
+int
+sys_env_set_affinity(envid_t envid, uint32_t mask)
+{
+	return syscall(SYS_env_set_affinity, 1, envid, mask, 0, 0, 0);
+}
+
+int
+sys_env_set_tickets(envid_t envid, unsigned tickets)
+{
+	return syscall(SYS_env_set_tickets, 1, envid, tickets, 0, 0, 0);
+}
+
+int
+sys_sched_set_policy(int policy)
+{
+	return syscall(SYS_sched_set_policy, 0, policy, 0, 0, 0, 0);
+}
+
 int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 {
@@ -117,10 +175,75 @@ sys_ipc_recv(void *dstva)
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_recv_timeout(void *dstva, uint32_t usec)
+{
+	return syscall(SYS_ipc_recv, 0, (uint32_t)dstva, usec, 0, 0, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, const struct IpcVec *vec,
+	     void *dstva, unsigned dstnpages)
+{
+	return syscall(SYS_ipc_call, 0, envid, value, (uint32_t) vec, (uint32_t) dstva, dstnpages);
+}
+
+int
+sys_ipc_reply_wait(envid_t whom, uint32_t value, const struct IpcVec *vec,
+		   void *dstva, unsigned dstnpages)
+{
+	return syscall(SYS_ipc_reply_wait, 0, whom, value, (uint32_t) vec, (uint32_t) dstva, dstnpages);
+}
+
 unsigned int
 sys_time_msec(void)
 {
-	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
+	// The same clock as the kernel's, read without a trap.
+	return time_msec();
+}
+
+int
+sys_sleep(uint32_t usec)
+{
+	return syscall(SYS_sleep, 0, usec, 0, 0, 0, 0);
+}
+
+int
+sys_batch(struct BatchRing *ring)
+{
+	return syscall(SYS_batch, 1, (uint32_t) ring, 0, 0, 0, 0);
+}
+
+int
+sys_syscall_stats(struct SyscallStat *stats, bool reset)
+{
+	return syscall(SYS_syscall_stats, 0, (uint32_t) stats, reset, 0, 0, 0);
+}
+
+int
+sys_cons_log(char *buf, size_t len)
+{
+	return syscall(SYS_cons_log, 0, (uint32_t) buf, len, 0, 0, 0);
+}
+
+// Blocks until there is console input; see sys_cons_read in
+// kern/syscall.c for why it may have to ask more than once.
+int
+sys_cons_read(char *buf, size_t len)
+{
+	int r;
+
+	if (len == 0)
+		return 0;
+	while ((r = syscall(SYS_cons_read, 0, (uint32_t) buf, len, 0, 0, 0)) == 0)
+		/* woken, but someone beat us to the input */;
+	return r;
+}
+
+int
+sys_time_usec(uint64_t *usec)
+{
+	return syscall(SYS_time_usec, 0, (uint32_t) usec, 0, 0, 0, 0);
 }
 
 int
@@ -134,3 +257,21 @@ sys_recv_packets(char *data, int *len, bool wait)
 {
     return syscall(SYS_recv_packets, 0, (uint32_t) data, (uint32_t) len, (uint32_t) wait, 0, 0);
 }
+
+int
+sys_page_pa(void *va)
+{
+	return syscall(SYS_page_pa, 0, (uint32_t) va, 0, 0, 0, 0);
+}
+
+int
+sys_ide_dma_base(void)
+{
+	return syscall(SYS_ide_dma_base, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_notify_wait(void)
+{
+	return syscall(SYS_notify_wait, 0, 0, 0, 0, 0, 0);
+}
@@ -8,8 +8,10 @@
 #define TIMER_INTERVAL 250
 
 // Virtual address at which to receive page mappings containing client requests.
+// Each request slot holds the request page followed by its data pages.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
+#define REQPAGES	(1 + NSREQ_MAXPAGES)
+#define REQVA		(0x0ffff000 - QUEUE_SIZE * REQPAGES * PGSIZE)
 
 /* timer.c */
 void timer(envid_t ns_envid, uint32_t initial_to);
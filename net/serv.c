@@ -51,6 +51,38 @@ static bool buse[QUEUE_SIZE];
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
 static int prev_i(int i) { return (i ? i-1 : QUEUE_SIZE-1); }
 
+// Replies produced by serve threads, waiting for the main loop to send
+// them.  Every outstanding request holds a buffer, so there can be at
+// most QUEUE_SIZE of them (plus one timer reply).
+struct reply {
+	envid_t whom;
+	int32_t r;
+};
+
+static struct reply replies[QUEUE_SIZE + 1];
+static int reply_head, reply_tail;
+
+static void
+put_reply(envid_t whom, int32_t r) {
+	int next = (reply_tail + 1) % (QUEUE_SIZE + 1);
+	if (next == reply_head)
+		panic("NS: reply queue overflow");
+
+	replies[reply_tail].whom = whom;
+	replies[reply_tail].r = r;
+	reply_tail = next;
+}
+
+static bool
+get_reply(struct reply *rep) {
+	if (reply_head == reply_tail)
+		return 0;
+
+	*rep = replies[reply_head];
+	reply_head = (reply_head + 1) % (QUEUE_SIZE + 1);
+	return 1;
+}
+
 static void *
 get_buffer(void) {
 	void *va;
@@ -64,7 +96,7 @@ get_buffer(void) {
 		return 0;
 	}
 
-	va = (void *)(REQVA + i * PGSIZE);
+	va = (void *)(REQVA + i * REQPAGES * PGSIZE);
 	buse[i] = 1;
 
 	return va;
@@ -72,7 +104,7 @@ get_buffer(void) {
 
 static void
 put_buffer(void *va) {
-	int i = ((uint32_t)va - REQVA) / PGSIZE;
+	int i = ((uint32_t)va - REQVA) / (REQPAGES * PGSIZE);
 	buse[i] = 0;
 }
 
@@ -173,20 +205,28 @@ process_timer(envid_t envid) {
 	thread_yield();
 	now = sys_time_msec();
 
-	to = TIMER_INTERVAL - (now - start);
-	ipc_send(envid, to, 0, 0);
+	// If the yield took a whole interval, tick again right away.
+	if (now - start >= TIMER_INTERVAL)
+		to = 0;
+	else
+		to = TIMER_INTERVAL - (now - start);
+	put_reply(envid, to);
 }
 
 struct st_args {
 	int32_t reqno;
 	uint32_t whom;
 	union Nsipc *req;
+	unsigned npages;	// request page plus data pages
 };
 
 static void
 serve_thread(uint32_t a) {
 	struct st_args *args = (struct st_args *)a;
 	union Nsipc *req = args->req;
+	char *data = (char *) req + PGSIZE;
+	int ndata = (args->npages - 1) * PGSIZE;
+	unsigned i;
 	int r;
 
 	switch (args->reqno) {
@@ -217,12 +257,25 @@ serve_thread(uint32_t a) {
 		r = lwip_listen(req->listen.req_s, req->listen.req_backlog);
 		break;
 	case NSREQ_RECV:
+		if (ndata > 0) {
+			r = lwip_recv(req->recv.req_s, data,
+				      MIN(req->recv.req_len, ndata),
+				      req->recv.req_flags);
+			break;
+		}
 		// Note that we read the request fields before we
 		// overwrite it with the response data.
 		r = lwip_recv(req->recv.req_s, req->recvRet.ret_buf,
-			      req->recv.req_len, req->recv.req_flags);
+			      MIN(req->recv.req_len, PGSIZE),
+			      req->recv.req_flags);
 		break;
 	case NSREQ_SEND:
+		if (ndata > 0) {
+			r = lwip_send(req->send.req_s, data,
+				      MIN(req->send.req_size, ndata),
+				      req->send.req_flags);
+			break;
+		}
 		r = lwip_send(req->send.req_s, &req->send.req_buf,
 			      req->send.req_size, req->send.req_flags);
 		break;
@@ -247,10 +300,11 @@ serve_thread(uint32_t a) {
 	}
 
 	if (args->reqno != NSREQ_INPUT)
-		ipc_send(args->whom, r, 0, 0);
+		put_reply(args->whom, r);
 
 	put_buffer(args->req);
-	sys_page_unmap(0, (void*) args->req);
+	for (i = 0; i < args->npages; i++)
+		sys_page_unmap(0, (char *) args->req + i * PGSIZE);
 	free(args);
 }
 
@@ -259,18 +313,33 @@ serve(void) {
 	int32_t reqno;
 	uint32_t whom;
 	int i, perm;
+	unsigned npages;
 	void *va;
+	struct reply rep, next;
+	struct IpcVec none;
 
 	while (1) {
-		// ipc_recv will block the entire process, so we flush
+		// ipc_reply_wait will block the entire process, so we flush
 		// all pending work from other threads.  We limit the
 		// number of yields in case there's a rogue thread.
 		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
 			thread_yield();
 
-		perm = 0;
+		// Send all but the last pending reply directly; the last
+		// one goes out together with the receive below.
+		rep.whom = 0;
+		rep.r = 0;
+		while (get_reply(&next)) {
+			if (rep.whom)
+				ipc_send(rep.whom, rep.r, 0, 0);
+			rep = next;
+		}
+
+		none.iv_npages = 0;
 		va = get_buffer();
-		reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		reqno = ipc_reply_waitv(rep.whom, rep.r, &none, (envid_t *) &whom,
+					(void *) va, REQPAGES, &npages);
+		perm = npages ? thisenv->env_ipc_perm : 0;
 		if (debug) {
 			cprintf("ns req %d from %08x\n", reqno, whom);
 		}
@@ -297,6 +366,7 @@ serve(void) {
 		args->reqno = reqno;
 		args->whom = whom;
 		args->req = va;
+		args->npages = npages;
 
 		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
 		thread_yield(); // let the thread created run
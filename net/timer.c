@@ -3,30 +3,24 @@
 void
 timer(envid_t ns_envid, uint32_t initial_to) {
 	int r;
-	uint32_t stop = sys_time_msec() + initial_to;
+	uint32_t to = initial_to;
 
 	binaryname = "ns_timer";
 
 	while (1) {
-		while((r = sys_time_msec()) < stop && r >= 0) {
-			sys_yield();
-		}
-		if (r < 0)
-			panic("sys_time_msec: %e", r);
-
-		ipc_send(ns_envid, NSREQ_TIMER, 0, 0);
+		// Sleep in the kernel, off the run queue, until the next tick.
+		// Never for more than an interval, which also keeps the
+		// microsecond count from overflowing.
+		to = MIN(to, TIMER_INTERVAL);
+		if ((r = sys_sleep(to * 1000)) < 0)
+			panic("sys_sleep: %e", r);
 
-		while (1) {
-			uint32_t to, whom;
-			to = ipc_recv((int32_t *) &whom, 0, 0);
-
-			if (whom != ns_envid) {
-				cprintf("NS TIMER: timer thread got IPC message from env %x not NS\n", whom);
-				continue;
-			}
+		// Only ns can deliver the reply to an ipc_call, so there is
+		// no need to check who sent it.
+		r = ipc_call(ns_envid, NSREQ_TIMER, 0, 0, 0, 0);
+		if (r < 0)
+			panic("ipc_call: %e", r);
 
-			stop = sys_time_msec() + to;
-			break;
-		}
+		to = r;
 	}
 }
@@ -0,0 +1,16 @@
+// Print the kernel's recent console output.
+
+#include <inc/lib.h>
+
+static char buf[16384];
+
+void
+umain(int argc, char **argv)
+{
+	int n;
+
+	binaryname = "dmesg";
+	if ((n = sys_cons_log(buf, sizeof(buf))) < 0)
+		panic("sys_cons_log: %e", n);
+	write(1, buf, n);
+}
@@ -0,0 +1,59 @@
+// Test the stride scheduler: fork children holding 100, 200 and 300
+// tickets, let them spin for a while, and check from the CPU time
+// accounting that they got CPU in proportion to their tickets.
+
+#include <inc/lib.h>
+
+#define NCHILD		3
+#define TOTAL_TICKETS	6	// 1 + 2 + 3, in units of 100
+#define TOLERANCE	5	// Percentage points either way
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD];
+	uint32_t mcycles[NCHILD], total = 0, share, want;
+	unsigned end;
+	int i, r;
+
+	if ((r = sys_sched_set_policy(SCHED_POLICY_STRIDE)) < 0)
+		panic("sys_sched_set_policy: %e", r);
+	// keep all children on one CPU, so they really compete
+	sys_env_set_affinity(0, 1);
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0)
+			while (1)
+				/* do nothing */;
+		if ((r = sys_env_set_tickets(kids[i], 100 * (i + 1))) < 0)
+			panic("sys_env_set_tickets: %e", r);
+	}
+
+	// Run ourselves on the biggest share while waiting.
+	sys_env_set_tickets(0, ENV_MAX_TICKETS);
+	end = sys_time_msec() + 2000;
+	while (sys_time_msec() < end)
+		sys_yield();
+
+	for (i = 0; i < NCHILD; i++) {
+		mcycles[i] = envs[ENVX(kids[i])].env_runtime >> 20;
+		total += mcycles[i];
+		sys_env_destroy(kids[i]);
+	}
+	sys_sched_set_policy(SCHED_POLICY_MLFQ);
+
+	if (total == 0)
+		panic("children did not run");
+	for (i = 0; i < NCHILD; i++) {
+		share = mcycles[i] * 100 / total;
+		want = 100 * (i + 1) / TOTAL_TICKETS;
+		cprintf("child %d: %d tickets, %u Mcycles, %u%% (want %u%%)\n",
+			i, 100 * (i + 1), mcycles[i], share, want);
+		if (share + TOLERANCE < want || share > want + TOLERANCE)
+			panic("child %d got %u%% of the CPU, want %u%%",
+			      i, share, want);
+	}
+	cprintf("stride OK\n");
+}
@@ -0,0 +1,43 @@
+// Print the kernel's system call statistics: the number of calls and
+// the average latency in cycles, for each type of caller.  Clearing
+// them is left to the monitor's "syscalls reset".
+
+#include <inc/lib.h>
+
+static struct SyscallStat stats[NSYSCALLS];
+
+static uint64_t
+avg(struct SyscallStat *ss, int type)
+{
+	uint64_t n;
+	int j;
+
+	for (n = 0, j = 0; j < SYSSTAT_NHIST; j++)
+		n += ss->ss_hist[type][j];
+	return n ? ss->ss_cycles[type] / n : 0;
+}
+
+void
+umain(int argc, char **argv)
+{
+	int i;
+
+	binaryname = "sysstats";
+	sys_syscall_stats(stats, 0);
+
+	cprintf("num %8s %8s %8s %8s %8s %8s\n", "user", "avg cyc",
+		"fs", "avg cyc", "ns", "avg cyc");
+	for (i = 0; i < NSYSCALLS; i++) {
+		if (!stats[i].ss_count[ENV_TYPE_USER]
+		    && !stats[i].ss_count[ENV_TYPE_FS]
+		    && !stats[i].ss_count[ENV_TYPE_NS])
+			continue;
+		cprintf("%3d %8llu %8llu %8llu %8llu %8llu %8llu\n", i,
+			stats[i].ss_count[ENV_TYPE_USER],
+			avg(&stats[i], ENV_TYPE_USER),
+			stats[i].ss_count[ENV_TYPE_FS],
+			avg(&stats[i], ENV_TYPE_FS),
+			stats[i].ss_count[ENV_TYPE_NS],
+			avg(&stats[i], ENV_TYPE_NS));
+	}
+}
@@ -0,0 +1,34 @@
+// Test batched system calls.
+
+#include <inc/lib.h>
+
+#define NPAGES	(2 * BATCH_NENT + 3)
+
+void
+umain(int argc, char **argv)
+{
+	char *va = (char *) UTEMP;
+	int i, r;
+
+	// More calls than the ring holds, so some flush on their own.
+	for (i = 0; i < NPAGES; i++)
+		if ((r = batch_page_alloc(0, va + i * PGSIZE, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("batch_page_alloc: %e", r);
+	if ((r = batch_flush()) < 0)
+		panic("batch_flush: %e", r);
+	for (i = 0; i < NPAGES; i++)
+		va[i * PGSIZE] = i;
+	cprintf("batch alloc ok\n");
+
+	// A failing entry stops the batch: the final alloc must not run.
+	for (i = 0; i < NPAGES; i++)
+		batch_page_unmap(0, va + i * PGSIZE);
+	batch_page_map(0, (void *) UTOP, 0, va, PTE_P|PTE_U);
+	batch_page_alloc(0, va, PTE_P|PTE_U|PTE_W);
+	if ((r = batch_flush()) != -E_INVAL)
+		panic("batch_flush returned %e, not invalid", r);
+	for (i = 0; i < NPAGES; i++)
+		if (uvpt[PGNUM(va + i * PGSIZE)] & PTE_P)
+			panic("page %d still mapped", i);
+	cprintf("batch error ok\n");
+}
@@ -0,0 +1,28 @@
+// Check that the user-level clock agrees with the kernel's, and that the
+// rest of the vDSO page is right.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t before, kern, after;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		before = time_usec();
+		sys_time_usec(&kern);
+		after = time_usec();
+		if (kern < before || after < kern)
+			panic("clock mismatch: %llu %llu %llu",
+			      before, kern, after);
+		sys_yield();
+	}
+	cprintf("clock ok: %llu usec\n", after);
+
+	if (vdso.vd_envid != thisenv->env_id)
+		panic("vdso envid %08x, not %08x", vdso.vd_envid, thisenv->env_id);
+	if (vdso.vd_cpu != thisenv->env_cpunum)
+		panic("vdso cpu %d, not %d", vdso.vd_cpu, thisenv->env_cpunum);
+	cprintf("vdso ok\n");
+}
@@ -0,0 +1,26 @@
+// Test sys_sleep and timed sys_ipc_recv.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	unsigned start, elapsed;
+	int r;
+
+	start = sys_time_msec();
+	if ((r = sys_sleep(100 * 1000)) < 0)
+		panic("sys_sleep: %e", r);
+	elapsed = sys_time_msec() - start;
+	if (elapsed < 100)
+		panic("sys_sleep woke after %u ms, not 100", elapsed);
+	cprintf("sleep ok\n");
+
+	start = sys_time_msec();
+	if ((r = sys_ipc_recv_timeout((void *) UTOP, 50 * 1000)) != -E_TIMEOUT)
+		panic("sys_ipc_recv_timeout returned %e, not timeout", r);
+	elapsed = sys_time_msec() - start;
+	if (elapsed < 50)
+		panic("sys_ipc_recv_timeout gave up after %u ms, not 50", elapsed);
+	cprintf("recv timeout ok\n");
+}